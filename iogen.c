@@ -43,27 +43,192 @@ static const char *iogen_license =
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/poll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/sysmacros.h>
+#include <sys/inotify.h>
+#include <libgen.h>
+#include <endian.h>
+#include <linux/fs.h>
+#include <linux/blkzoned.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include "clparse.h"
 
 #define PRINT_DIAG -1000
 
 extern char *iogen_version;
 
-typedef enum { READ, WRITE, RW, DC } op_t;
+/* FLUSH, DISCARD and ZERO are mixed into the IO of the above, see
+ * --fsync, --discard-pct and --zero-pct, RESET and FINISH of zones
+ * into the writes of --zoned, and the metadata ops from OPEN on into
+ * the IO of --files.
+ */
+typedef enum { READ, WRITE, RW, DC, COPY, FLUSH, DISCARD, ZERO, RESET,
+	       FINISH, OPEN, STAT, CREATE, UNLINK, RENAME } op_t;
 
 static const char *op2str[] = {
 	[READ] = "READ",
 	[WRITE]= "WRITE",
 	[RW]   = "RW",
 	[DC]   = "DC",
+	[COPY] = "COPY",
+	[FLUSH]   = "FLUSH",
+	[DISCARD] = "DISCARD",
+	[ZERO]    = "ZERO",
+	[RESET]   = "RESET",
+	[FINISH]  = "FINISH",
+	[OPEN]    = "OPEN",
+	[STAT]    = "STAT",
+	[CREATE]  = "CREATE",
+	[UNLINK]  = "UNLINK",
+	[RENAME]  = "RENAME",
+};
+
+/* sync seeks, then reads or writes at the file offset, psync and
+ * pvsync2 read and write at the IO's offset.
+ */
+typedef enum { ENGINE_SYNC, ENGINE_PSYNC, ENGINE_PVSYNC2,
+	       ENGINE_URING } engine_t;
+
+typedef enum { COPY_RANGE, COPY_SPLICE, COPY_RW } copy_t;
+
+static const char *copy2str[] = {
+	[COPY_RANGE]  = "copy_file_range",
+	[COPY_SPLICE] = "splice",
+	[COPY_RW]     = "rw",
+};
+
+static const char *engine2str[] = {
+	[ENGINE_SYNC]    = "sync",
+	[ENGINE_PSYNC]   = "psync",
+	[ENGINE_PVSYNC2] = "pvsync2",
+	[ENGINE_URING]   = "uring",
+};
+
+typedef enum { DIST_UNIFORM, DIST_ZIPF, DIST_PARETO, DIST_NORMAL,
+	       DIST_REGIONS } dist_t;
+
+#define MAX_REGIONS	16	  /* of --dist regions */
+
+typedef enum { SEQ_SHARED, SEQ_PARTITION, SEQ_STRIDE } seq_layout_t;
+
+static const char *seq2str[] = {
+	[SEQ_SHARED]    = "shared",
+	[SEQ_PARTITION] = "partition",
+	[SEQ_STRIDE]    = "stride",
+};
+
+/* --bssplit: IO size is that of a random one of BS_SLOTS slots, each
+ * size taking up as many slots as its percentage.
+ */
+#define BS_SLOTS	100
+#define BS_READ		0
+#define BS_WRITE	1	  /* and DC */
+
+/* --compress-pct and --dedupe-pct: writes take their data from
+ * PAYLOAD_SIZE bytes, made of chunks random to the percent and zeros
+ * after that. Duplicates point at its start, the other writes copy a
+ * part of it and stamp each chunk, so that no two of them are alike.
+ */
+#define PAYLOAD_SIZE	(8 << 20)
+#define COMPRESS_CHUNK	4096
+
+/* Latency histogram, log-linear: values below 2*LAT_SUB ns have a
+ * bucket each, above that each power of two is split into LAT_SUB
+ * buckets, i.e. a relative error of at most 1/LAT_SUB.
+ */
+#define LAT_BITS	5
+#define LAT_SUB		(1 << LAT_BITS)
+#define LAT_BUCKETS	((65 - LAT_BITS) * LAT_SUB)
+
+typedef enum { LAT_READ, LAT_WRITE, LAT_VERIFY, LAT_COPY, LAT_FLUSH,
+	       LAT_DISCARD, LAT_ZERO, LAT_RESET, LAT_FINISH, LAT_OPEN,
+	       LAT_STAT, LAT_CREATE, LAT_UNLINK, LAT_RENAME, LAT_NUM } lat_t;
+
+static const char *lat2str[] = {
+	[LAT_READ]    = "Read",
+	[LAT_WRITE]   = "Write",
+	[LAT_VERIFY]  = "DC verify",
+	[LAT_COPY]    = "Copy",
+	[LAT_FLUSH]   = "Flush",
+	[LAT_DISCARD] = "Discard",
+	[LAT_ZERO]    = "Write zeroes",
+	[LAT_RESET]   = "Zone reset",
+	[LAT_FINISH]  = "Zone finish",
+	[LAT_OPEN]    = "Open",
+	[LAT_STAT]    = "Stat",
+	[LAT_CREATE]  = "Create",
+	[LAT_UNLINK]  = "Unlink",
+	[LAT_RENAME]  = "Rename",
+};
+
+static const char *lat2csv[] = {
+	[LAT_READ]    = "read",
+	[LAT_WRITE]   = "write",
+	[LAT_VERIFY]  = "verify",
+	[LAT_COPY]    = "copy",
+	[LAT_FLUSH]   = "flush",
+	[LAT_DISCARD] = "discard",
+	[LAT_ZERO]    = "zero",
+	[LAT_RESET]   = "zone_reset",
+	[LAT_FINISH]  = "zone_finish",
+	[LAT_OPEN]    = "open",
+	[LAT_STAT]    = "stat",
+	[LAT_CREATE]  = "create",
+	[LAT_UNLINK]  = "unlink",
+	[LAT_RENAME]  = "rename",
+};
+
+static const lat_t op2lat[] = {
+	[READ]    = LAT_READ,
+	[WRITE]   = LAT_WRITE,
+	[COPY]    = LAT_COPY,
+	[FLUSH]   = LAT_FLUSH,
+	[DISCARD] = LAT_DISCARD,
+	[ZERO]    = LAT_ZERO,
+	[RESET]   = LAT_RESET,
+	[FINISH]  = LAT_FINISH,
+	[OPEN]    = LAT_OPEN,
+	[STAT]    = LAT_STAT,
+	[CREATE]  = LAT_CREATE,
+	[UNLINK]  = LAT_UNLINK,
+	[RENAME]  = LAT_RENAME,
+};
+
+struct lat_hist {
+	uint64_t	count;
+	uint64_t	sum;		  /* ns */
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LAT_BUCKETS];
 };
 
+/* Each child updates its own stats without locks, while the parent
+ * may be reading them: one writer, any number of readers.
+ */
+#define STAT_SET(_X, _V)	__atomic_store_n(&(_X), (_V), __ATOMIC_RELAXED)
+#define STAT_GET(_X)		__atomic_load_n(&(_X), __ATOMIC_RELAXED)
+#define STAT_ADD(_X, _V)	STAT_SET(_X, (_X) + (_V))
+
 struct thread_stats {
 	/* Bytes */
 	uint64_t	bytes_read;
@@ -72,14 +237,111 @@ struct thread_stats {
 	/* IOP */
 	uint64_t	read_iops;
 	uint64_t	write_iops;
+
+	/* Copies are counted by lat[LAT_COPY] */
+	uint64_t	bytes_copied;
+
+	/* IOs which would have blocked, with --nowait */
+	uint64_t	would_block;
+
+	/* Latency, per op type */
+	struct lat_hist	lat[LAT_NUM];
+
+	/* How late replayed IO was issued, see account_drift() */
+	struct lat_hist	drift;
+
+	/* With --restart, see wait_for_device() */
+	uint64_t	outages;
+	struct lat_hist	detect;	  /* how long the IO which failed took */
+	struct lat_hist	outage;	  /* until the device could be opened */
+	struct lat_hist	recover;  /* from then until IO succeeded */
+
+	/* CPU time past the ramp, set when the thread exits */
+	uint64_t	user_us;
+	uint64_t	sys_us;
+	uint64_t	end_ns;	  /* CLOCK_MONOTONIC, when it exited */
+
+	/* Bumped when the above are reset, at the end of the ramp */
+	uint64_t	epoch;
+};
+
+/* Settings changed over the control socket, shared by the parent
+ * with all IO threads. The parent bumps gen after each change, see
+ * control_check().
+ */
+#define CTL_RATE	(1 << 0)
+#define CTL_RWMIX	(1 << 1)
+#define CTL_IODEPTH	(1 << 2)
+#define CTL_ACTIVE	(1 << 3)
+
+struct control {
+	uint64_t gen;
+	int	set;		  /* CTL_* of the below given */
+	unsigned long long rate_iops;	/* all threads together, 0: no limit */
+	unsigned rwmix_read;	  /* the first group's until set */
+	unsigned iodepth;	  /* the first group's until set */
+	unsigned active;	  /* threads with a lower index run */
+	unsigned num_threads;
+	int	paused;
+	int	stop;
+};
+
+/* A binary trace is "IOGT", a u32 version, then these records,
+ * all little endian. Blkparse text is read into the same records.
+ */
+#define TRACE_MAGIC	"IOGT"
+#define TRACE_VERSION	1
+
+struct trace_rec {
+	uint64_t	ts_ns;	  /* since the start of the trace */
+	uint64_t	offset;	  /* bytes */
+	uint32_t	count;	  /* bytes */
+	uint16_t	op;	  /* READ or WRITE */
+	uint16_t	dev;	  /* device, modulo the number given */
+};
+
+/* A sequential write required, or preferred, zone of a zoned device,
+ * in bytes.
+ */
+struct zone {
+	unsigned long long start;
+	unsigned long long len;
+	unsigned long long cap;	  /* writable, from start */
+	unsigned long long wp;	  /* write pointer, start + cap if full */
+	int	open;		  /* in thread->open_zones */
+	int	busy;		  /* a write in flight */
+};
+
+/* A file of --files, its index in thread->files naming it, see
+ * fs_path().
+ */
+struct fs_file {
+	unsigned long long size;	/* written up to */
+	unsigned long long target;	/* laid out to, extended up to */
+	int	exists;
+	int	renamed;		/* at its other name */
+	int	fd;			/* cached, else -1 */
+	int	prev;			/* fd cache LRU list, by index */
+	int	next;
 };
 
 struct thread_info {
 	pid_t	pid;
+	pid_t	tid;		  /* pid, or the thread id with --pthreads */
 	int	index;
 	FILE	*fp;		  /* log output */
 
+	/* The job file group this thread is in, NULL if none */
+	const char *group;
+
+	int	pthreads;
+	pthread_t pthread;
+	int	done_fd;	  /* --pthreads: write our index when done */
+	int	cpu;		  /* pinned to, -1 if not */
+	int	node;		  /* NUMA node of cpu */
+
 	unsigned int	seed;
+	uint64_t	io_num;	  /* number of the next IO */
 	unsigned	dry_run;
 	unsigned	io_log;
 	unsigned long long min_io;
@@ -89,24 +351,175 @@ struct thread_info {
 	long long	num_ios;
 	op_t	op;
 
+	/* The op mix of RW and the IO sizes, see io_op() and io_count() */
+	unsigned rwmix_read;	  /* percent of RW ops which read */
+	unsigned long long (*bssplit)[BS_SLOTS];  /* sizes, NULL if none */
+
 	char	*device;
 	int	o_direct;
 	int	o_sync;
 	int	restart;
+	int	is_blk;
+
+	/* Flush after every sync_every writes or sync_bytes written,
+	 * see sync_count() */
+	unsigned long long sync_every;
+	unsigned long long sync_bytes;
+	int	sync_data;	  /* fdatasync() rather than fsync() */
+	unsigned long long sync_writes;	  /* since the last flush */
+	unsigned long long sync_written;
+	unsigned long long sync_due;	  /* bytes to flush, 0 if none */
+	int	fua;		  /* writes with RWF_DSYNC */
+	unsigned discard_pct;
+	unsigned zero_pct;
+
+	/* COPY: from fd to copy_fd, at the same offset */
+	char	*copy_to;
+	copy_t	copy_method;
+	int	copy_fd;
+	int	copy_pipe[2];	  /* splice */
+
+	/* --zoned: writes go to the write pointers of up to
+	 * max_open_zones of this thread's zones, see zone_write() */
+	int	zoned;
+	unsigned max_open_zones;
+	struct zone *zones;
+	unsigned num_zones;
+	unsigned *open_zones;	  /* indices into zones */
+	unsigned num_open;
+	unsigned next_zone;	  /* to open */
+	unsigned zone_cur;	  /* open zone to write next */
+	unsigned long long zone_min;	/* finish a zone with less left */
+
+	/* --files: IO goes to the files of a tree in the device, a
+	 * directory, through a cache of up to fd_cache open files, see
+	 * fs_setup() */
+	unsigned files;
+	unsigned long long *file_size;	/* BS_SLOTS sizes */
+	unsigned fd_cache;
+	unsigned stat_pct;
+	unsigned create_pct;
+	unsigned unlink_pct;
+	unsigned rename_pct;
+	unsigned meta_pct;	  /* all of the above */
+	struct fs_file *fs;
+	unsigned fs_dirs;
+	int	fs_dir;		  /* this thread's tree */
+	unsigned fs_cached;
+	int	fs_head;	  /* most recently used, -1 if none */
+	int	fs_tail;	  /* least recently used */
 
-	int	big_buf;
 	char	*buf;
 	char    *buf2;
 
-	struct thread_stats  stats;
+	/* All IO buffers, allocated once */
+	char	*pool;
+	size_t	pool_size;
+	size_t	buf_size;
+	int	hugepages;
+
+	/* With --compress-pct or --dedupe-pct, writes come out of this,
+	 * see payload_io() */
+	int	payload;
+	unsigned compress_pct;
+	unsigned dedupe_pct;
+	char	*payload_buf;
+	size_t	payload_size;
+
+	/* IO sizes and offsets are multiples of align */
+	unsigned long long align;
+	unsigned long long min_blk;
+	unsigned long long max_blk;
+	unsigned long long min_span_blk;
+
+	/* Random offsets follow this, NULL if uniform, see dist_blk() */
+	struct dist *dist;
+
+	/* Open loop rate limiting, see rate_sched() */
+	double	rate_iops;
+	double	rate_bw;
+	int	poisson;
+	uint64_t burst_on_ns;
+	uint64_t burst_off_ns;
+	uint64_t rate_start_ns;
+	double	rate_t;		  /* ns of active time scheduled so far */
+
+	/* With --io-log, handed each IO, see log_io() */
+	struct io_log *iolog;
+
+	/* Replay these instead of generating IO, see trace_io() */
+	struct trace_rec *trace;
+	uint64_t trace_len;
+	double	replay_speed;	  /* 0: as fast as possible */
+	uint64_t trace_ts_ns;	  /* of the first record replayed */
+
+	/* CLOCK_MONOTONIC deadlines, 0 if none, see check_deadlines() */
+	uint64_t ramp_ns;
+	uint64_t stop_ns;
+	uint64_t last_ns;	  /* a timestamp of the last IO */
+	int	stopping;
+	uint64_t cpu_base[2];	  /* user and sys usec at the end of the ramp */
+
+	/* With --control, see control_check() */
+	struct control *ctl;
+	uint64_t ctl_gen;
+	int	paused;
+	unsigned max_inflight;	  /* of iodepth */
+
+	/* CLOCK_MONOTONIC, 0 if the device isn't lost */
+	uint64_t outage_ns;	  /* when it was lost */
+	uint64_t reopen_ns;	  /* when it was last reopened */
+
+	struct thread_stats  *stats;	  /* shared with the parent */
 
 	unsigned long long fixed;
 	unsigned seq;
 
-	unsigned long long last_end;
+	/* Sequential IO walks chunks of stride bytes of [seq_lo, seq_hi),
+	 * seq_step apart, see seq_next() */
+	seq_layout_t seq_layout;
+	int	seq_reverse;
+	unsigned long long seq_skip;	/* hole between IOs */
+	unsigned long long seq_stride;
+	unsigned long long seq_step;
+	unsigned long long seq_lo;
+	unsigned long long seq_hi;
+	unsigned long long seq_first;	/* chunk */
+	unsigned long long seq_chunk;
+	unsigned seq_rank;		/* of the threads on the device */
+	unsigned seq_peers;
+
+	unsigned long long last_end;	/* reversed: the start of the last IO */
 
 	int fd;			  /* device */
 	int open_flags;
+
+	engine_t engine;
+	unsigned iodepth;
+	int	sqpoll;
+	int	iopoll;
+	int	rw_flags;	  /* pvsync2: RWF_HIPRI, RWF_NOWAIT */
+	unsigned no_nowait;	  /* 1 << op of those RWF_NOWAIT fails for */
+};
+
+/* A single IO, as generated by prep_io() and carried out by an engine.
+ */
+struct io_u {
+	op_t	rw;
+	off64_t	start;
+	size_t	count;
+	void	*buf;
+	void	*buf2;		  /* read back buffer for DC */
+	void	*own_buf;	  /* buf, unless payload_io() moved it */
+
+	uint64_t num;		  /* IO number, see io_rand() */
+	uint64_t sched_ns;	  /* due, with rate limiting, else 0 */
+	int	index;		  /* slot index, async engines */
+	int	phase;		  /* DC: 0 write, 1 read back */
+	struct zone *zone;	  /* --zoned: written */
+	unsigned file;		  /* --files: index of the file */
+	uint64_t start_ns;	  /* op issued */
+	uint64_t issue_ns;	  /* this phase issued */
 };
 
 /* ---------- Get program arguments ---------- */
@@ -115,7 +528,12 @@ struct thread_info {
 
 #define MIN_IO_DEFAULT		512
 #define MAX_IO_DEFAULT		(128*1024)
-#define SMALL_BUF_LIMIT 	MAX_IO_DEFAULT
+
+#define FILE_SIZE_DEFAULT	"1m"
+#define FD_CACHE_DEFAULT	64
+
+#define PAGE_SIZE		4096
+#define HUGE_PAGE_SIZE		(2*1024*1024)
 
 static struct prog_opts {
 	unsigned int	seed;
@@ -132,9 +550,76 @@ static struct prog_opts {
 	char	**devices;
 	unsigned long long fixed;
 	unsigned long long seq;
+	seq_layout_t seq_layout;
+	unsigned long long seq_stride;
+	int	seq_reverse;
+	unsigned long long seq_skip;
 	int     o_direct;
 	int	o_sync;
 	int	restart;
+	unsigned long long sync_every;
+	unsigned long long sync_bytes;
+	int	sync_data;
+	int	fua;
+	unsigned discard_pct;
+	unsigned zero_pct;
+	int	payload;
+	unsigned compress_pct;
+	unsigned dedupe_pct;
+	char	*copy_to;
+	copy_t	copy_method;
+	int	zoned;
+	unsigned max_open_zones;
+	unsigned files;
+	char	*file_size_spec;
+	unsigned long long file_size[BS_SLOTS];
+	unsigned fd_cache;
+	unsigned stat_pct;
+	unsigned create_pct;
+	unsigned unlink_pct;
+	unsigned rename_pct;
+	engine_t engine;
+	unsigned iodepth;
+	int	sqpoll;
+	int	iopoll;
+	int	hipri;
+	int	nowait;
+	unsigned stats_interval;
+	int	stats_csv;
+	int	pthreads;
+	int	num_cpus;
+	int	*cpus;
+	unsigned long long align;
+	int	hugepages;
+	char	*simd;
+	unsigned long long first_io;
+	unsigned long long rate_iops;
+	unsigned long long rate_bw;
+	unsigned long long total_rate_iops;
+	unsigned long long total_rate_bw;
+	int	poisson;
+	unsigned long long burst_on_ms;
+	unsigned long long burst_off_ms;
+	unsigned long long runtime;
+	unsigned long long ramp_time;
+	char	*replay;
+	double	replay_speed;
+	char	*decode_log;
+	char	*dist_spec;
+	dist_t	dist;
+	double	dist_a;
+	double	dist_b;
+	int	num_regions;
+	double	region_access[MAX_REGIONS];
+	double	region_size[MAX_REGIONS];
+	char	*job_file;
+	unsigned rwmix_read;
+	char	*bssplit_spec;
+	unsigned long long bssplit[2][BS_SLOTS];
+	unsigned long long slo_p99;
+	char	*control;
+	char	*report;
+	int	report_csv;
 } prog_opts = {
 	.seed = DEFAULT_PARENT_SEED,
 	.dry_run = 0,
@@ -150,9 +635,69 @@ static struct prog_opts {
 	.devices = NULL,
 	.fixed = 0,
 	.seq = 0,
+	.seq_layout = SEQ_SHARED,
+	.seq_stride = 0,
+	.seq_reverse = 0,
+	.seq_skip = 0,
 	.o_direct = 0,
 	.o_sync = 0,
 	.restart = 0,
+	.sync_every = 0,
+	.sync_bytes = 0,
+	.sync_data = 0,
+	.fua = 0,
+	.discard_pct = 0,
+	.zero_pct = 0,
+	.payload = 0,
+	.compress_pct = 0,
+	.dedupe_pct = 0,
+	.copy_to = NULL,
+	.copy_method = COPY_RANGE,
+	.zoned = 0,
+	.max_open_zones = 0,
+	.files = 0,
+	.file_size_spec = NULL,
+	.fd_cache = FD_CACHE_DEFAULT,
+	.stat_pct = 0,
+	.create_pct = 0,
+	.unlink_pct = 0,
+	.rename_pct = 0,
+	.engine = ENGINE_SYNC,
+	.iodepth = 1,
+	.sqpoll = 0,
+	.iopoll = 0,
+	.hipri = 0,
+	.nowait = 0,
+	.stats_interval = 0,
+	.stats_csv = 0,
+	.pthreads = 0,
+	.num_cpus = 0,
+	.cpus = NULL,
+	.align = 0,
+	.hugepages = 0,
+	.simd = "auto",
+	.first_io = 0,
+	.rate_iops = 0,
+	.rate_bw = 0,
+	.total_rate_iops = 0,
+	.total_rate_bw = 0,
+	.poisson = 0,
+	.burst_on_ms = 0,
+	.burst_off_ms = 0,
+	.runtime = 0,
+	.ramp_time = 0,
+	.replay = NULL,
+	.replay_speed = 1,
+	.decode_log = NULL,
+	.dist_spec = "uniform",
+	.dist = DIST_UNIFORM,
+	.job_file = NULL,
+	.rwmix_read = 50,
+	.bssplit_spec = NULL,
+	.slo_p99 = 0,
+	.control = NULL,
+	.report = NULL,
+	.report_csv = 0,
 };
 	
 static int get_ull_value(char *str, unsigned long long *val)
@@ -276,28 +821,29 @@ int get_max_span(char *value, void *_opts)
 	return 0;
 }
 
-int get_devices(int index_last, int argc, char *argv[])
+int get_devices(struct prog_opts *opts, int index_last, int argc,
+		char *argv[])
 {
 	int num_dev = argc - index_last;
 	int i;
 
-	prog_opts.devices = malloc(num_dev * sizeof(char *));
-	if (!prog_opts.devices) {
+	opts->devices = malloc(num_dev * sizeof(char *));
+	if (!opts->devices) {
 		fprintf(stderr, "Out of memory\n");
 		exit(1);
 	}
 
 	for (i = 0; i < num_dev; i++)
-		prog_opts.devices[i] = argv[i+index_last];
+		opts->devices[i] = argv[i+index_last];
 
-	prog_opts.num_devices = num_dev;
+	opts->num_devices = num_dev;
 
 	return 0;
 }
 
-void free_devices(void)
+void free_devices(struct prog_opts *opts)
 {
-	free(prog_opts.devices);
+	free(opts->devices);
 }
 
 int get_op(char *value, void *_opts)
@@ -312,6 +858,8 @@ int get_op(char *value, void *_opts)
 		opts->op = RW;
 	else if (strcmp(value, "DC") == 0)
 		opts->op = DC;
+	else if (strcmp(value, "COPY") == 0)
+		opts->op = COPY;
 	else {
 		fprintf(stderr, "Incorrect value for op: %s\n", value);
 		return -1;
@@ -334,6 +882,15 @@ int get_num_ios(char *value, void *_opts)
 	return 0;
 }
 
+int get_decode_log(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->decode_log = value;
+
+	return 0;
+}
+
 int set_io_log(char *value, void *_opts)
 {
 	struct prog_opts *opts = _opts;
@@ -368,418 +925,6505 @@ int set_seq(char *value, void *_opts)
 	return 0;
 }
 
-int set_odirect(char *value, void *_opts)
+int get_seq_layout(char *value, void *_opts)
 {
 	struct prog_opts *opts = _opts;
 
-	opts->o_direct = 1;
+	if (strcmp(value, "shared") == 0) {
+		opts->seq_layout = SEQ_SHARED;
+	} else if (strcmp(value, "partition") == 0) {
+		opts->seq_layout = SEQ_PARTITION;
+	} else if (strncmp(value, "stride:", 7) == 0) {
+		opts->seq_layout = SEQ_STRIDE;
+		if (get_ull_value(value + 7, &opts->seq_stride) ||
+		    opts->seq_stride == 0) {
+			fprintf(stderr, "Incorrect stride: %s\n", value + 7);
+			return -1;
+		}
+	} else {
+		fprintf(stderr, "Incorrect value for seq layout: %s\n",
+			value);
+		return -1;
+	}
+	opts->seq = 1;
 
 	return 0;
 }
 
-int set_osync(char *value, void *_opts)
+int set_seq_reverse(char *value, void *_opts)
 {
 	struct prog_opts *opts = _opts;
 
-	opts->o_sync = 1;
+	opts->seq_reverse = 1;
+	opts->seq = 1;
 
 	return 0;
 }
 
-int set_restart(char *value, void *_opts)
+int get_seq_skip(char *value, void *_opts)
 {
 	struct prog_opts *opts = _opts;
+	int res;
 
-	opts->restart = 1;
+	res = get_ull_value(value, &opts->seq_skip);
+	if (res) {
+		fprintf(stderr, "Incorrect seq skip: %s\n", value);
+		return -1;
+	}
+	opts->seq = 1;
 
 	return 0;
 }
 
-void print_h(FILE *out);
-
-int print_help(char *value, void *_opts)
+int set_odirect(char *value, void *_opts)
 {
-	print_h(stdout);
-	return PRINT_DIAG;
-}
+	struct prog_opts *opts = _opts;
 
-int print_version(char *value, void *_opts)
-{
-	fprintf(stdout, "Version: %s\n", iogen_version);
-	return PRINT_DIAG;
-}
+	opts->o_direct = 1;
 
-int print_license(char *value, void *_opts)
-{
-	fprintf(stdout, "%s", iogen_license);
-	return PRINT_DIAG;
+	return 0;
 }
 
-const struct clparse_opt cmd_opts[] = {
-	{ '\0', "seed", 1, get_seed, "Initial random seed, default 0x5A33D9" },
-	{ '\0', "dry-run", 0, set_dry_run, "Do not actually do IO" },
-	{ '\0', "io-log", 0, set_io_log, "Print IO ops log" },
-	{ '\0', "num-threads", 1, get_num_threads, "Number of IO threads (default 1)" },
-	{ '\0', "min-io", 1, get_min_io, "Minimum IO size (default 512)" },
-	{ '\0', "max-io", 1, get_max_io, "Maximum IO size (default 128 KiB)" },
-	{ '\0', "fixed", 1, get_fixed, "IO size is fixed at that number, i.e. not random" },
-	{ '\0', "min-span", 1, get_min_span, "Minimum span (default 0)" },
-	{ '\0', "max-span", 1, get_max_span, "Maximum span (default device size)" },
-	{ '\0', "seq", 0, set_seq, "Do sequential IO, i.e. not random" },
-	{ '\0', "op", 1, get_op, "One of: READ, WRITE, RW, DC (default: READ)" },
-	{ '\0', "num-ios", 1, get_num_ios, "Number of IO ops per thread (default: -1, infinite)" },
-	{ '\0', "o_direct", 0, set_odirect, "Set the O_DIRECT flag when opening the device, see open(2)." },
-	{ '\0', "o_sync", 0, set_osync, "Set the O_SYNC flag when opening the device, see open(2)." },
-	{ '\0', "restart", 0, set_restart, "Restart I/O when device reappears" },
-	{ 'l', "license", 0, print_license, "Print the license to stdout" },
-	{ 'h', "help", 0, print_help, "Print this help and the version to stdout" },
-	{ 'v', "version", 0, print_version, "Print the version to stdout" },
-};
+int set_osync(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
 
-#define NUM_OPTIONS	(sizeof(cmd_opts)/sizeof(cmd_opts[0]))
+	opts->o_sync = 1;
 
-void print_h(FILE *out)
-{
-	fprintf(out,
-		"Usage: iogen [options] <device> <device> ...\n");
-	fprintf(out, "Options:\n");
-	cl_print_opts_help(cmd_opts, NUM_OPTIONS, out);
-	fprintf(out, "Append either case 'k', 'm' or 'g' to numerical arguments to multiply by 1 KiB,"
-		" 1 MiB or 1 GiB.\n");
-	fprintf(out, "A single device is assigned to one or more threads.\n");
-	fprintf(out, "Version: %s\n", iogen_version);
+	return 0;
 }
 
-/* ---------- Time ---------- */
-
-void print_time(FILE *fp)
+int set_restart(char *value, void *_opts)
 {
-	time_t t;
-	struct tm tm;
-	char s[100];
-
-	t = time(NULL);
-	localtime_r(&t, &tm); /* gmtime_r(&t, &tm) -- UTC */
-	strftime(s, 100, "%a, %d %b %Y %H:%M:%S %z (%Z)", &tm);
-	fprintf(fp, "Time: %s\n", s);
-}
+	struct prog_opts *opts = _opts;
 
-/* ---------- Thread ---------- */
+	opts->restart = 1;
 
-#define RANDOM(_A, _B)	((_A)+(unsigned long long)(((_B)-(_A)+1)*drand48()))
+	return 0;
+}
 
-int do_io_op(struct thread_info *thread)
+int get_fsync(char *value, void *_opts)
 {
-	int res = 0;
-	op_t rw;
-	void *buf = NULL, *buf2 = NULL;
-	size_t count, i;
-	off64_t start;
-
-	if (thread->op == READ)
-		rw = READ;
-	else if (thread->op == WRITE)
-		rw = WRITE;
-	else if (thread->op == DC)
-		rw = DC;
-	else {
-		rw = RANDOM(0, 1);
-	}
-
-	if (thread->fixed)
-		count = thread->fixed;
-	else
-		count = RANDOM(thread->min_io, thread->max_io);
+	struct prog_opts *opts = _opts;
+	int res;
 
-	if (thread->seq) {
-		start = thread->last_end;
-		if (start >= thread->max_span)
-			start = 0;
-		thread->last_end = start + count;
-	} else
-		start = RANDOM(thread->min_span, thread->max_span-count-1);
-
-	if (thread->big_buf) {
-		buf = malloc(count);
-		if (rw == DC)
-			buf2 = malloc(count);
-		else
-			buf2 = buf;
-	} else {
-		buf = thread->buf;
-		if (rw == DC)
-			buf2 = thread->buf2;
-		else
-			buf2 = buf;
+	res = get_ull_value(value, &opts->sync_every);
+	if (res) {
+		fprintf(stderr, "Incorrect fsync: %s\n", value);
+		return -1;
 	}
+	opts->sync_data = 0;
 
-	if (!buf || !buf2) {
-		if (thread->big_buf) {
-			free(buf);
-			if (rw == DC)
-				free(buf2);
-		}
+	return 0;
+}
 
-		fprintf(thread->fp, "Out of memory for buffer for "
-			"op: %s offs: %lu count: %lu\n",
-			op2str[rw], start, count);
+int get_fdatasync(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
 
+	res = get_ull_value(value, &opts->sync_every);
+	if (res) {
+		fprintf(stderr, "Incorrect fdatasync: %s\n", value);
 		return -1;
 	}
+	opts->sync_data = 1;
+
+	return 0;
+}
 
-	if (rw == DC) {
-		uint8_t *p = buf;
+int get_sync_bytes(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
 
-		for (i = 0; i < count; i++)
-			p[i] = RANDOM(0, 0xFF);
+	res = get_ull_value(value, &opts->sync_bytes);
+	if (res) {
+		fprintf(stderr, "Incorrect sync bytes: %s\n", value);
+		return -1;
 	}
 
-	if (!thread->dry_run) {
-		if (lseek64(thread->fd, start, SEEK_SET) == -1) {
-			fprintf(thread->fp, "lseek64 error (%s) for "
-				"op: %s offs: %lu count: %lu\n",
-				strerror(errno), op2str[rw], start, count);
-			return -1;
-		}
+	return 0;
+}
 
-		switch (rw) {
-		case DC:
-		case WRITE:
-			res = write(thread->fd, buf, count);
-			if (res > 0) {
-				thread->stats.bytes_written += res;
-				thread->stats.write_iops++;
-			}
-			if (rw != DC)
-				break;
-			else if (lseek64(thread->fd, start, SEEK_SET) == -1) {
-				fprintf(thread->fp, "lseek64 error (%s) for "
-					"op: %s offs: %lu count: %lu\n",
-					strerror(errno), op2str[rw], start,
-					count);
-				res = -1;
-				goto Out;
-			}
-		case READ:
-			res = read(thread->fd, buf2, count);
-			if (res > 0) {
-				thread->stats.bytes_read += res;
-				thread->stats.read_iops++;
-			}
-			break;
-		default:
-			break;
-		}
+int set_fua(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
 
-		if (rw == DC) {
-			uint8_t *a = buf, *b = buf2;
+	opts->fua = 1;
 
-			for (i = 0; i < count; i++) {
-				if (a[i] != b[i]) {
-					fprintf(thread->fp,
-						"op: %-5s offs: %16lu "
-						"wrote %02Xh read %02Xh\n",
-						op2str[rw], start+i,
-						a[i], b[i]);
-					res = -1;
-					break;
-				}
-			}
-		}
-	}
+	return 0;
+}
 
-	if (thread->io_log || res == -1) {
-		fprintf(thread->fp, "op: %-5s offs: %16lu count: %6lu "
-			"errno: %d: %s\n",
-			op2str[rw], start, count, errno, strerror(errno));
-	}
- Out:
-	if (thread->big_buf) {
-		free(buf);
-		if (rw == DC)
-			free(buf2);
+static int get_pct(char *value, unsigned *pct, const char *what)
+{
+	char *end;
+
+	*pct = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') || *pct > 100) {
+		fprintf(stderr, "Incorrect %s: %s\n", what, value);
+		return -1;
 	}
 
-	return res;
+	return 0;
 }
 
-void print_stats(struct thread_info *th)
+int get_discard_pct(char *value, void *_opts)
 {
-	fprintf(th->fp, "Bytes read:    %16lu\n", th->stats.bytes_read);
-	fprintf(th->fp, "Bytes written: %16lu\n", th->stats.bytes_written);
-	fprintf(th->fp, "Total:         %16lu\n", th->stats.bytes_read +
-		th->stats.bytes_written);
-	fprintf(th->fp, "Read IOPs:     %8lu\n", th->stats.read_iops);
-	fprintf(th->fp, "Write IOPs:    %8lu\n", th->stats.write_iops);
-	fprintf(th->fp, "Total:         %8lu\n", th->stats.read_iops +
-		th->stats.write_iops);
-}
+	struct prog_opts *opts = _opts;
 
-struct thread_info *this;
+	return get_pct(value, &opts->discard_pct, "discard percent");
+}
 
-void sighandler_thread(int sig)
+int get_zero_pct(char *value, void *_opts)
 {
-	fprintf(this->fp, "Thread %d terminated by signal %d\n",
-		getpid(), sig);
-	print_stats(this);
-	print_time(this->fp);
-	signal(sig, SIG_DFL);
-	kill(getpid(), sig);
+	struct prog_opts *opts = _opts;
+
+	return get_pct(value, &opts->zero_pct, "zero percent");
 }
 
-void wait_for_device(struct thread_info *thread)
+int get_compress_pct(char *value, void *_opts)
 {
-	fprintf(thread->fp, "Device %s disappeared on ", thread->device);
-	print_time(thread->fp);
-	fprintf(thread->fp, "Waiting for device %s to come back on...\n",
-		thread->device);
+	struct prog_opts *opts = _opts;
 
-	close(thread->fd);
+	opts->payload = 1;
+	return get_pct(value, &opts->compress_pct, "compress percent");
+}
 
-	do {
-		sleep(5);
-		thread->fd = open(thread->device, thread->open_flags);
-	} while (thread->fd == -1);
+int get_dedupe_pct(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
 
-	fprintf(thread->fp, "Device %s came back on ", thread->device);
-	print_time(thread->fp);
+	opts->payload = 1;
+	return get_pct(value, &opts->dedupe_pct, "dedupe percent");
 }
 
-int do_thread(struct thread_info *thread)
+int get_copy_to(char *value, void *_opts)
 {
-	FILE *fp;
-	char thread_name[255];
+	struct prog_opts *opts = _opts;
 
-	this = thread;
-	sprintf(thread_name, "/tmp/iogen_thread.%d", getpid());
-	fp = fopen(thread_name, "w+");
-	if (fp == NULL) {
-		fprintf(stderr, "Couldn't open %s: %s\n",
-			thread_name, strerror(errno));
-		exit(1);
-	}
-	setvbuf(fp, NULL, _IONBF, 1);
-	thread->fp = fp;
-	srand48(thread->seed);
+	opts->copy_to = value;
 
-	/* Catch and report terminating signals, then
+	return 0;
+}
+
+int get_copy_method(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "copy_file_range") == 0)
+		opts->copy_method = COPY_RANGE;
+	else if (strcmp(value, "splice") == 0)
+		opts->copy_method = COPY_SPLICE;
+	else if (strcmp(value, "rw") == 0)
+		opts->copy_method = COPY_RW;
+	else {
+		fprintf(stderr, "Incorrect value for copy-method: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int set_zoned(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->zoned = 1;
+
+	return 0;
+}
+
+int get_max_open_zones(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->max_open_zones = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->max_open_zones == 0) {
+		fprintf(stderr, "Incorrect max-open-zones: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_engine(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "sync") == 0)
+		opts->engine = ENGINE_SYNC;
+	else if (strcmp(value, "psync") == 0)
+		opts->engine = ENGINE_PSYNC;
+	else if (strcmp(value, "pvsync2") == 0)
+		opts->engine = ENGINE_PVSYNC2;
+	else if (strcmp(value, "uring") == 0)
+		opts->engine = ENGINE_URING;
+	else {
+		fprintf(stderr, "Incorrect value for engine: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_iodepth(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->iodepth = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->iodepth == 0) {
+		fprintf(stderr, "Incorrect iodepth: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int set_sqpoll(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->sqpoll = 1;
+
+	return 0;
+}
+
+int set_iopoll(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->iopoll = 1;
+
+	return 0;
+}
+
+int set_hipri(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->hipri = 1;
+
+	return 0;
+}
+
+int set_nowait(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->nowait = 1;
+
+	return 0;
+}
+
+int get_slo_p99(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->slo_p99 = strtoull(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->slo_p99 == 0) {
+		fprintf(stderr, "Incorrect p99 SLO: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_stats_interval(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->stats_interval = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0')) {
+		fprintf(stderr, "Incorrect stats interval: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_stats_format(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "text") == 0)
+		opts->stats_csv = 0;
+	else if (strcmp(value, "csv") == 0)
+		opts->stats_csv = 1;
+	else {
+		fprintf(stderr, "Incorrect value for stats format: %s\n",
+			value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_control(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->control = value;
+
+	return 0;
+}
+
+int get_report(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->report = value;
+
+	return 0;
+}
+
+int get_report_format(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "json") == 0)
+		opts->report_csv = 0;
+	else if (strcmp(value, "csv") == 0)
+		opts->report_csv = 1;
+	else {
+		fprintf(stderr, "Incorrect value for report format: %s\n",
+			value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int set_pthreads(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->pthreads = 1;
+
+	return 0;
+}
+
+/* A list of CPUs, e.g. "0,2,4-7".
+ */
+int get_cpus(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *p = value, *end;
+	unsigned long a, b;
+
+	do {
+		a = strtoul(p, &end, 0);
+		if (end == p)
+			goto Err;
+		b = a;
+		if (*end == '-') {
+			p = end + 1;
+			b = strtoul(p, &end, 0);
+			if (end == p || b < a)
+				goto Err;
+		}
+		if (*end != ',' && *end != ' ' && *end != '\0')
+			goto Err;
+		for ( ; a <= b; a++) {
+			int *cpus;
+
+			cpus = realloc(opts->cpus, (opts->num_cpus + 1) *
+				       sizeof(*cpus));
+			if (!cpus)
+				goto Err;
+			opts->cpus = cpus;
+			opts->cpus[opts->num_cpus++] = a;
+		}
+		p = end + 1;
+	} while (*end == ',');
+
+	return 0;
+ Err:
+	fprintf(stderr, "Incorrect cpu list: %s\n", value);
+	return -1;
+}
+
+int get_align(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->align);
+	if (res || opts->align == 0 || (opts->align & (opts->align - 1))) {
+		fprintf(stderr, "Incorrect align, must be a power of 2: %s\n",
+			value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int set_hugepages(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->hugepages = 1;
+
+	return 0;
+}
+
+int get_simd(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "auto") && strcmp(value, "avx2") &&
+	    strcmp(value, "sse2") && strcmp(value, "none")) {
+		fprintf(stderr, "Incorrect value for simd: %s\n", value);
+		return -1;
+	}
+	opts->simd = value;
+
+	return 0;
+}
+
+int get_first_io(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->first_io);
+	if (res) {
+		fprintf(stderr, "Incorrect first io: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_runtime(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->runtime);
+	if (res) {
+		fprintf(stderr, "Incorrect runtime: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_ramp_time(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->ramp_time);
+	if (res) {
+		fprintf(stderr, "Incorrect ramp time: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_replay(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->replay = value;
+
+	return 0;
+}
+
+int get_replay_speed(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->replay_speed = strtod(value, &end);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->replay_speed < 0) {
+		fprintf(stderr, "Incorrect replay speed: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* One of: uniform, zipf:<theta>, pareto:<h>,
+ * normal:<center %>:<stddev %>, regions:<access %>/<size %>:...
+ */
+int get_dist(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	double access = 0, size = 0;
+	char *p, *end;
+
+	opts->dist_spec = value;
+	if (strcmp(value, "uniform") == 0) {
+		opts->dist = DIST_UNIFORM;
+	} else if (strncmp(value, "zipf:", 5) == 0) {
+		opts->dist = DIST_ZIPF;
+		opts->dist_a = strtod(value + 5, &end);
+		if (end == value + 5 || *end != '\0' || opts->dist_a <= 0)
+			goto Err;
+	} else if (strncmp(value, "pareto:", 7) == 0) {
+		opts->dist = DIST_PARETO;
+		opts->dist_a = strtod(value + 7, &end);
+		if (end == value + 7 || *end != '\0' ||
+		    opts->dist_a <= 0 || opts->dist_a >= 1)
+			goto Err;
+	} else if (strncmp(value, "normal:", 7) == 0) {
+		opts->dist = DIST_NORMAL;
+		p = value + 7;
+		opts->dist_a = strtod(p, &end) / 100;
+		if (end == p || *end != ':')
+			goto Err;
+		p = end + 1;
+		opts->dist_b = strtod(p, &end) / 100;
+		if (end == p || *end != '\0' || opts->dist_a < 0 ||
+		    opts->dist_a > 1 || opts->dist_b <= 0)
+			goto Err;
+	} else if (strncmp(value, "regions:", 8) == 0) {
+		opts->dist = DIST_REGIONS;
+		opts->num_regions = 0;
+		p = value + 8;
+		do {
+			int z = opts->num_regions;
+
+			if (z == MAX_REGIONS)
+				goto Err;
+			opts->region_access[z] = strtod(p, &end) / 100;
+			if (end == p || *end != '/')
+				goto Err;
+			p = end + 1;
+			opts->region_size[z] = strtod(p, &end) / 100;
+			if (end == p || (*end != ':' && *end != '\0') ||
+			    opts->region_access[z] < 0 ||
+			    opts->region_size[z] <= 0)
+				goto Err;
+			access += opts->region_access[z];
+			size += opts->region_size[z];
+			opts->num_regions++;
+			p = end + 1;
+		} while (*end == ':');
+		if (fabs(access - 1) > 1e-6 || fabs(size - 1) > 1e-6)
+			goto Err;
+	} else {
+		goto Err;
+	}
+
+	return 0;
+ Err:
+	fprintf(stderr, "Incorrect distribution: %s\n", value);
+	return -1;
+}
+
+int get_job_file(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	opts->job_file = value;
+
+	return 0;
+}
+
+int get_rwmix_read(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	unsigned long long pct;
+
+	if (get_ull_value(value, &pct) || pct > 100) {
+		fprintf(stderr, "Incorrect rwmix read: %s\n", value);
+		return -1;
+	}
+	opts->rwmix_read = pct;
+
+	return 0;
+}
+
+/* Fill the slots from <size>/<pct>:<size>/<pct>:... at *p, up to a
+ * ',' or the end. Sizes without a pct share what's left equally.
+ */
+int parse_bssplit(char **p, unsigned long long *slots)
+{
+	unsigned long long size[BS_SLOTS];
+	int pct[BS_SLOTS];
+	int i, j, n = 0, sum = 0, shares = 0, left, slot = 0;
+	char *end;
+
+	do {
+		if (n == BS_SLOTS)
+			return -1;
+		size[n] = strtoull(*p, &end, 0);
+		if (end == *p)
+			return -1;
+		switch (tolower(*end)) {
+		case 'k':
+			size[n] *= 1024;
+			end++;
+			break;
+		case 'm':
+			size[n] *= 1024*1024;
+			end++;
+			break;
+		case 'g':
+			size[n] *= 1024*1024*1024;
+			end++;
+			break;
+		}
+		if (size[n] == 0)
+			return -1;
+		pct[n] = -1;
+		if (*end == '/') {
+			unsigned long v;
+
+			*p = end + 1;
+			if (!isdigit(**p))
+				return -1;
+			v = strtoul(*p, &end, 0);
+			if (end == *p || v > 100)
+				return -1;
+			pct[n] = v;
+			sum += pct[n];
+		} else {
+			shares++;
+		}
+		n++;
+		*p = end + 1;
+	} while (*end == ':');
+	*p = end;
+
+	if (sum > 100 || (shares == 0 && sum != 100))
+		return -1;
+	left = shares;
+
+	for (i = 0; i < n; i++) {
+		int k = pct[i];
+
+		if (k == -1) {
+			/* the last one gets what's left of the division */
+			k = (100 - sum) / shares;
+			if (--left == 0)
+				k += (100 - sum) % shares;
+		}
+		for (j = 0; j < k; j++)
+			slots[slot++] = size[i];
+	}
+
+	return 0;
+}
+
+/* <split> for all ops, or <read split>,<write split>
+ */
+int get_bssplit(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *p = value;
+
+	if (parse_bssplit(&p, opts->bssplit[BS_READ]))
+		goto Err;
+	if (*p == ',') {
+		p++;
+		if (parse_bssplit(&p, opts->bssplit[BS_WRITE]))
+			goto Err;
+	} else {
+		memcpy(opts->bssplit[BS_WRITE], opts->bssplit[BS_READ],
+		       sizeof(opts->bssplit[BS_READ]));
+	}
+	if (*p != '\0' && *p != ' ')
+		goto Err;
+	opts->bssplit_spec = value;
+
+	return 0;
+ Err:
+	fprintf(stderr, "Incorrect bssplit: %s\n", value);
+	return -1;
+}
+
+int get_files(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->files = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->files == 0) {
+		fprintf(stderr, "Incorrect files: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* <size>/<pct>:..., as that of --bssplit
+ */
+int get_file_size(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *p = value;
+
+	if (parse_bssplit(&p, opts->file_size) ||
+	    (*p != '\0' && *p != ' ')) {
+		fprintf(stderr, "Incorrect file-size: %s\n", value);
+		return -1;
+	}
+	opts->file_size_spec = value;
+
+	return 0;
+}
+
+int get_fd_cache(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->fd_cache = strtoul(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->fd_cache == 0) {
+		fprintf(stderr, "Incorrect fd-cache: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_stat_pct(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	return get_pct(value, &opts->stat_pct, "stat percent");
+}
+
+int get_create_pct(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	return get_pct(value, &opts->create_pct, "create percent");
+}
+
+int get_unlink_pct(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	return get_pct(value, &opts->unlink_pct, "unlink percent");
+}
+
+int get_rename_pct(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	return get_pct(value, &opts->rename_pct, "rename percent");
+}
+
+int get_rate_iops(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->rate_iops);
+	if (res) {
+		fprintf(stderr, "Incorrect rate iops: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_rate_bw(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->rate_bw);
+	if (res) {
+		fprintf(stderr, "Incorrect rate bw: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_total_rate_iops(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->total_rate_iops);
+	if (res) {
+		fprintf(stderr, "Incorrect total rate iops: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_total_rate_bw(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	int res;
+
+	res = get_ull_value(value, &opts->total_rate_bw);
+	if (res) {
+		fprintf(stderr, "Incorrect total rate bw: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+int get_arrival(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+
+	if (strcmp(value, "const") == 0)
+		opts->poisson = 0;
+	else if (strcmp(value, "poisson") == 0)
+		opts->poisson = 1;
+	else {
+		fprintf(stderr, "Incorrect value for arrival: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* <on ms>:<off ms>
+ */
+int get_burst(char *value, void *_opts)
+{
+	struct prog_opts *opts = _opts;
+	char *end;
+
+	opts->burst_on_ms = strtoull(value, &end, 0);
+	if (end == value || *end != ':')
+		goto Err;
+	value = end + 1;
+	opts->burst_off_ms = strtoull(value, &end, 0);
+	if (end == value || (*end != ' ' && *end != '\0') ||
+	    opts->burst_on_ms == 0)
+		goto Err;
+
+	return 0;
+ Err:
+	fprintf(stderr, "Incorrect burst, want <on ms>:<off ms>: %s\n",
+		value);
+	return -1;
+}
+
+void print_h(FILE *out);
+
+int print_help(char *value, void *_opts)
+{
+	print_h(stdout);
+	return PRINT_DIAG;
+}
+
+int print_version(char *value, void *_opts)
+{
+	fprintf(stdout, "Version: %s\n", iogen_version);
+	return PRINT_DIAG;
+}
+
+int print_license(char *value, void *_opts)
+{
+	fprintf(stdout, "%s", iogen_license);
+	return PRINT_DIAG;
+}
+
+const struct clparse_opt cmd_opts[] = {
+	{ '\0', "seed", 1, get_seed, "Initial random seed, default 0x5A33D9" },
+	{ '\0', "dry-run", 0, set_dry_run, "Do not actually do IO" },
+	{ '\0', "io-log", 0, set_io_log, "Log IO ops to /tmp/iogen_thread.<pid>.iolog, see --decode-log" },
+	{ '\0', "decode-log", 1, get_decode_log, "Print this IO log file as text and exit" },
+	{ '\0', "job-file", 1, get_job_file, "Run the groups of threads of this file, each with its own options, see iogen.c" },
+	{ '\0', "num-threads", 1, get_num_threads, "Number of IO threads (default 1)" },
+	{ '\0', "min-io", 1, get_min_io, "Minimum IO size (default 512)" },
+	{ '\0', "max-io", 1, get_max_io, "Maximum IO size (default 128 KiB)" },
+	{ '\0', "fixed", 1, get_fixed, "IO size is fixed at that number, i.e. not random" },
+	{ '\0', "min-span", 1, get_min_span, "Minimum span (default 0)" },
+	{ '\0', "max-span", 1, get_max_span, "Maximum span (default device size)" },
+	{ '\0', "seq", 0, set_seq, "Do sequential IO, i.e. not random" },
+	{ '\0', "seq-layout", 1, get_seq_layout, "Threads on a device do sequential IO over, one of: shared, partition (a slice each), stride:<bytes> (interleaved chunks) of the span (default: shared)" },
+	{ '\0', "seq-reverse", 0, set_seq_reverse, "Do sequential IO from the end of the span backwards" },
+	{ '\0', "seq-skip", 1, get_seq_skip, "Leave a hole of that many bytes between sequential IOs, backwards with --seq-reverse (default 0)" },
+	{ '\0', "op", 1, get_op, "One of: READ, WRITE, RW, DC, COPY (default: READ)" },
+	{ '\0', "num-ios", 1, get_num_ios, "Number of IO ops per thread (default: -1, infinite)" },
+	{ '\0', "first-io", 1, get_first_io, "Start each thread at this IO number, e.g. to redo a failed IO (default 0)" },
+	{ '\0', "runtime", 1, get_runtime, "Stop after that many seconds past the ramp time, whichever of this and --num-ios comes first" },
+	{ '\0', "ramp-time", 1, get_ramp_time, "Don't count the stats of the first that many seconds (default 0)" },
+	{ '\0', "replay", 1, get_replay, "Replay this blkparse output or binary trace, rather than generate IO" },
+	{ '\0', "replay-speed", 1, get_replay_speed, "Replay at that many times the trace's speed, 0 for as fast as possible (default 1)" },
+	{ '\0', "dist", 1, get_dist, "Random offsets are, one of: uniform, zipf:<theta>, pareto:<h> (h of the IO to the first 1-h of the span), normal:<center %>:<stddev %>, regions:<access %>/<size %>:... (default: uniform)" },
+	{ '\0', "rwmix-read", 1, get_rwmix_read, "Percent of --op RW ops which read (default 50)" },
+	{ '\0', "bssplit", 1, get_bssplit, "IO sizes, <size>/<pct>:..., or <read sizes>,<write sizes>, e.g. 8k,4k/40:1m/60" },
+	{ '\0', "rate-iops", 1, get_rate_iops, "Issue IO at this many IOPS per thread, regardless of completions" },
+	{ '\0', "rate-bw", 1, get_rate_bw, "Issue IO at this many bytes per second per thread, regardless of completions" },
+	{ '\0', "total-rate-iops", 1, get_total_rate_iops, "Like --rate-iops, but for all threads together, the tighter of the two applying if both are given" },
+	{ '\0', "total-rate-bw", 1, get_total_rate_bw, "Like --rate-bw, but for all threads together, the tighter of the two applying if both are given" },
+	{ '\0', "arrival", 1, get_arrival, "Rate limited IO arrives at, one of: const, poisson (default: const) intervals" },
+	{ '\0', "burst", 1, get_burst, "Rate limited IO arrives in bursts, <on ms>:<off ms>" },
+	{ '\0', "o_direct", 0, set_odirect, "Set the O_DIRECT flag when opening the device, see open(2)." },
+	{ '\0', "o_sync", 0, set_osync, "Set the O_SYNC flag when opening the device, see open(2)." },
+	{ '\0', "restart", 0, set_restart, "Restart I/O when device reappears" },
+	{ '\0', "fsync", 1, get_fsync, "fsync(2) after every that many writes, 0 for only --sync-bytes (default: never)" },
+	{ '\0', "fdatasync", 1, get_fdatasync, "Like --fsync, but fdatasync(2)" },
+	{ '\0', "sync-bytes", 1, get_sync_bytes, "Also fsync, or fdatasync, after that many bytes written (default: never)" },
+	{ '\0', "fua", 0, set_fua, "Write with RWF_DSYNC, i.e. each write is durable when it completes" },
+	{ '\0', "discard-pct", 1, get_discard_pct, "Percent of ops which discard: BLKDISCARD, or punch a hole in a file (default 0)" },
+	{ '\0', "zero-pct", 1, get_zero_pct, "Percent of ops which write zeroes: BLKZEROOUT, or zero a range of a file (default 0)" },
+	{ '\0', "compress-pct", 1, get_compress_pct, "Write data of which that percent compresses away, rather than what's in the buffers (default 0, with --dedupe-pct)" },
+	{ '\0', "dedupe-pct", 1, get_dedupe_pct, "Percent of writes of the same data, rather than what's in the buffers (default 0, with --compress-pct)" },
+	{ '\0', "copy-to", 1, get_copy_to, "COPY: the device copied to, at the offsets read from" },
+	{ '\0', "copy-method", 1, get_copy_method, "COPY: one of copy_file_range, splice, rw (default: copy_file_range)" },
+	{ '\0', "zoned", 0, set_zoned, "Write at the write pointers of the device's sequential zones, resetting and finishing them as they fill, needs --o_direct" },
+	{ '\0', "max-open-zones", 1, get_max_open_zones, "--zoned: zones each thread writes at a time (default: the iodepth)" },
+	{ '\0', "files", 1, get_files, "Do IO to that many files in a tree in each device, a directory, per thread, laid out first" },
+	{ '\0', "file-size", 1, get_file_size, "--files: sizes, <size>/<pct>:... as --bssplit (default 1m)" },
+	{ '\0', "fd-cache", 1, get_fd_cache, "--files: files each thread keeps open, least recently used closed first (default 64)" },
+	{ '\0', "stat-pct", 1, get_stat_pct, "--files: percent of ops which stat(2) a file (default 0)" },
+	{ '\0', "create-pct", 1, get_create_pct, "--files: percent of ops which create a file, or truncate it if all exist (default 0)" },
+	{ '\0', "unlink-pct", 1, get_unlink_pct, "--files: percent of ops which unlink a file (default 0)" },
+	{ '\0', "rename-pct", 1, get_rename_pct, "--files: percent of ops which rename a file, to another directory (default 0)" },
+	{ '\0', "engine", 1, get_engine, "One of: sync (lseek, then read or write), psync (pread, pwrite), pvsync2 (preadv2, pwritev2), uring (default: sync)" },
+	{ '\0', "iodepth", 1, get_iodepth, "IOs in flight per thread, uring engine (default 1)" },
+	{ '\0', "sqpoll", 0, set_sqpoll, "Use a kernel SQ polling thread, uring engine" },
+	{ '\0', "iopoll", 0, set_iopoll, "Poll for IO completions, uring engine, needs --o_direct" },
+	{ '\0', "hipri", 0, set_hipri, "Poll for IO completions with RWF_HIPRI, pvsync2 engine, needs --o_direct" },
+	{ '\0', "nowait", 0, set_nowait, "Count the IOs which would block with RWF_NOWAIT, then do them blocking, pvsync2 engine" },
+	{ '\0', "slo-p99", 1, get_slo_p99, "Search for the highest IOPS whose p99 latency is within this many usec, stepping the threads, or the iodepth with the uring engine, then the total rate" },
+	{ '\0', "stats-interval", 1, get_stats_interval, "Print all threads' stats to stdout every that many seconds (default 0, never)" },
+	{ '\0', "stats-format", 1, get_stats_format, "Format of the interval stats, one of: text, csv (default: text)" },
+	{ '\0', "control", 1, get_control, "Take commands on a UNIX socket at this path while running, \"help\" lists them" },
+	{ '\0', "report", 1, get_report, "Write the total, per device, per thread and per op results to this file, - for stdout" },
+	{ '\0', "report-format", 1, get_report_format, "Format of the report, one of: json, csv (default: json)" },
+	{ '\0', "pthreads", 0, set_pthreads, "Run the IO threads as pthreads rather than as processes" },
+	{ '\0', "cpus", 1, get_cpus, "Pin thread N to the Nth CPU of this list, e.g. 0,2,4-7" },
+	{ '\0', "align", 1, get_align, "IO sizes and offsets are multiples of this (default 1, or the logical block size with --o_direct)" },
+	{ '\0', "hugepages", 0, set_hugepages, "Back the IO buffers with huge pages" },
+	{ '\0', "simd", 1, get_simd, "DC data generation and compare, one of: auto, avx2, sse2, none (default: auto)" },
+	{ 'l', "license", 0, print_license, "Print the license to stdout" },
+	{ 'h', "help", 0, print_help, "Print this help and the version to stdout" },
+	{ 'v', "version", 0, print_version, "Print the version to stdout" },
+};
+
+#define NUM_OPTIONS	(sizeof(cmd_opts)/sizeof(cmd_opts[0]))
+
+void print_h(FILE *out)
+{
+	fprintf(out,
+		"Usage: iogen [options] <device> <device> ...\n");
+	fprintf(out, "Options:\n");
+	cl_print_opts_help(cmd_opts, NUM_OPTIONS, out);
+	fprintf(out, "Append either case 'k', 'm' or 'g' to numerical arguments to multiply by 1 KiB,"
+		" 1 MiB or 1 GiB.\n");
+	fprintf(out, "A single device is assigned to one or more threads.\n");
+	fprintf(out, "Version: %s\n", iogen_version);
+}
+
+/* ---------- Time ---------- */
+
+void print_time(FILE *fp)
+{
+	time_t t;
+	struct tm tm;
+	char s[100];
+
+	t = time(NULL);
+	localtime_r(&t, &tm); /* gmtime_r(&t, &tm) -- UTC */
+	strftime(s, 100, "%a, %d %b %Y %H:%M:%S %z (%Z)", &tm);
+	fprintf(fp, "Time: %s\n", s);
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ---------- Latency ---------- */
+
+static inline int lat_index(uint64_t ns)
+{
+	int msb, shift;
+
+	if (ns < 2*LAT_SUB)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	shift = msb - LAT_BITS;
+	return shift * LAT_SUB + (ns >> shift);
+}
+
+/* The midpoint of the values a bucket covers.
+ */
+static uint64_t lat_value(int index)
+{
+	int shift;
+	uint64_t m;
+
+	if (index < 2*LAT_SUB)
+		return index;
+	shift = index / LAT_SUB - 1;
+	m = index - shift * LAT_SUB;
+	return (m << shift) + (1ULL << (shift - 1));
+}
+
+static inline void lat_add(struct lat_hist *h, uint64_t ns)
+{
+	if (h->count == 0 || ns < h->min)
+		STAT_SET(h->min, ns);
+	if (ns > h->max)
+		STAT_SET(h->max, ns);
+	STAT_ADD(h->count, 1);
+	STAT_ADD(h->sum, ns);
+	STAT_ADD(h->buckets[lat_index(ns)], 1);
+}
+
+void lat_merge(struct lat_hist *dst, struct lat_hist *src)
+{
+	uint64_t min, max;
+	int i;
+
+	if (STAT_GET(src->count) == 0)
+		return;
+	min = STAT_GET(src->min);
+	max = STAT_GET(src->max);
+	if (dst->count == 0 || min < dst->min)
+		dst->min = min;
+	if (max > dst->max)
+		dst->max = max;
+	dst->count += STAT_GET(src->count);
+	dst->sum += STAT_GET(src->sum);
+	for (i = 0; i < LAT_BUCKETS; i++)
+		dst->buckets[i] += STAT_GET(src->buckets[i]);
+}
+
+/* What was added to a counter since prev was taken. If it went
+ * down, it was reset in between and all of it is new.
+ */
+static inline uint64_t stat_delta(uint64_t cur, uint64_t prev)
+{
+	return cur >= prev ? cur - prev : cur;
+}
+
+/* Add to d what was added to cur since prev was taken. d's min and
+ * max are left to lat_bounds().
+ */
+void lat_delta(struct lat_hist *d, struct lat_hist *cur,
+	       struct lat_hist *prev)
+{
+	int i;
+
+	d->count += stat_delta(cur->count, prev->count);
+	d->sum += stat_delta(cur->sum, prev->sum);
+	for (i = 0; i < LAT_BUCKETS; i++)
+		d->buckets[i] += stat_delta(cur->buckets[i],
+					    prev->buckets[i]);
+}
+
+/* Set min and max to those of the buckets.
+ */
+void lat_bounds(struct lat_hist *h)
+{
+	int i, first = -1, last = -1;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		if (h->buckets[i]) {
+			if (first == -1)
+				first = i;
+			last = i;
+		}
+	}
+	h->min = first == -1 ? 0 : lat_value(first);
+	h->max = last == -1 ? 0 : lat_value(last);
+}
+
+/* The value below which pct percent of the samples fall.
+ */
+uint64_t lat_percentile(struct lat_hist *h, double pct)
+{
+	uint64_t want, seen = 0, v;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+	want = (uint64_t) (h->count * pct / 100.0 + 0.5);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			break;
+	}
+	v = lat_value(i);
+	if (v < h->min)
+		v = h->min;
+	if (v > h->max)
+		v = h->max;
+
+	return v;
+}
+
+static const double lat_pcts[] = { 50, 90, 99, 99.9, 99.99 };
+
+#define NUM_LAT_PCTS	(sizeof(lat_pcts)/sizeof(lat_pcts[0]))
+
+void print_lat(FILE *fp, const char *name, struct lat_hist *h)
+{
+	int i;
+
+	if (h->count == 0)
+		return;
+	fprintf(fp, "%s latency (usec): count: %lu min: %.1f avg: %.1f "
+		"max: %.1f\n", name, h->count, h->min / 1000.0,
+		h->sum / 1000.0 / h->count, h->max / 1000.0);
+	fprintf(fp, "   ");
+	for (i = 0; i < NUM_LAT_PCTS; i++)
+		fprintf(fp, " p%g: %.1f", lat_pcts[i],
+			lat_percentile(h, lat_pcts[i]) / 1000.0);
+	fprintf(fp, " max: %.1f\n", h->max / 1000.0);
+}
+
+void merge_stats(struct thread_stats *dst, struct thread_stats *src)
+{
+	int i;
+
+	dst->bytes_read += STAT_GET(src->bytes_read);
+	dst->bytes_written += STAT_GET(src->bytes_written);
+	dst->read_iops += STAT_GET(src->read_iops);
+	dst->write_iops += STAT_GET(src->write_iops);
+	dst->bytes_copied += STAT_GET(src->bytes_copied);
+	dst->would_block += STAT_GET(src->would_block);
+	for (i = 0; i < LAT_NUM; i++)
+		lat_merge(&dst->lat[i], &src->lat[i]);
+	lat_merge(&dst->drift, &src->drift);
+	dst->outages += STAT_GET(src->outages);
+	lat_merge(&dst->detect, &src->detect);
+	lat_merge(&dst->outage, &src->outage);
+	lat_merge(&dst->recover, &src->recover);
+	dst->user_us += STAT_GET(src->user_us);
+	dst->sys_us += STAT_GET(src->sys_us);
+	if (STAT_GET(src->end_ns) > dst->end_ns)
+		dst->end_ns = STAT_GET(src->end_ns);
+}
+
+/* What reads, writes and copies, the ops which move data, add up to.
+ */
+static inline uint64_t data_ios(struct thread_stats *st)
+{
+	return st->read_iops + st->write_iops + st->lat[LAT_COPY].count;
+}
+
+static inline uint64_t data_bytes(struct thread_stats *st)
+{
+	return st->bytes_read + st->bytes_written + st->bytes_copied;
+}
+
+void data_lat(struct lat_hist *h, struct thread_stats *st)
+{
+	memset(h, 0, sizeof(*h));
+	lat_merge(h, &st->lat[LAT_READ]);
+	lat_merge(h, &st->lat[LAT_WRITE]);
+	lat_merge(h, &st->lat[LAT_COPY]);
+}
+
+/* Called by the thread which owns st, the only one writing it.
+ * The parent may read a mix of old and zeroed values meanwhile,
+ * and tells that this happened by the epoch.
+ */
+void reset_stats(struct thread_stats *st)
+{
+	uint64_t epoch = STAT_GET(st->epoch);
+
+	memset(st, 0, sizeof(*st));
+	__atomic_store_n(&st->epoch, epoch + 1, __ATOMIC_RELEASE);
+}
+
+/* ---------- Random numbers ---------- */
+
+/* Every random number an IO needs is a function of the thread's
+ * seed and index, the IO number and what it's for, computed with the
+ * Philox4x32-10 counter based generator. So IO N can be recomputed
+ * on its own, without generating IOs 0..N-1 first.
+ */
+typedef enum { RND_OP, RND_SIZE, RND_OFFSET, RND_DATA, RND_ARRIVAL,
+	       RND_BUCKET, RND_PAYLOAD, RND_POOL, RND_FILE, RND_FILE_SIZE } rnd_t;
+
+#define PHILOX_M0	0xD2511F53
+#define PHILOX_M1	0xCD9E8D57
+#define PHILOX_W0	0x9E3779B9
+#define PHILOX_W1	0xBB67AE85
+
+static inline void philox4x32(uint32_t ctr[4], uint32_t k0, uint32_t k1)
+{
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		uint64_t p0 = (uint64_t) PHILOX_M0 * ctr[0];
+		uint64_t p1 = (uint64_t) PHILOX_M1 * ctr[2];
+
+		ctr[0] = (p1 >> 32) ^ ctr[1] ^ k0;
+		ctr[1] = p1;
+		ctr[2] = (p0 >> 32) ^ ctr[3] ^ k1;
+		ctr[3] = p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+}
+
+static inline uint64_t rnd64(uint32_t k0, uint32_t k1, uint64_t num,
+			     unsigned what)
+{
+	uint32_t ctr[4] = { num, num >> 32, what, 0 };
+
+	philox4x32(ctr, k0, k1);
+	return (uint64_t) ctr[1] << 32 | ctr[0];
+}
+
+/* 64 random bits for what of IO num of this thread.
+ */
+static inline uint64_t io_rand(struct thread_info *thread, uint64_t num,
+			       rnd_t what)
+{
+	return rnd64(thread->seed, thread->index, num, what);
+}
+
+/* Map 64 random bits onto [a, b].
+ */
+static inline unsigned long long rnd_range(uint64_t r, unsigned long long a,
+					   unsigned long long b)
+{
+	return a + (unsigned long long)
+		(((unsigned __int128) r * (b - a + 1)) >> 64);
+}
+
+/* ---------- Offset distributions ---------- */
+
+/* A skewed distribution is made of DIST_BUCKETS equal parts of the
+ * span, the first being the hottest for zipf and pareto. An IO picks
+ * a part with the alias method, i.e. one random number and a compare,
+ * then an offset uniformly within the part. The table only depends
+ * on the distribution, so all threads share it.
+ */
+#define DIST_SHIFT	20
+#define DIST_BUCKETS	(1U << DIST_SHIFT)
+
+struct dist {
+	const char	*spec;
+	uint32_t	*prob;	  /* keep bucket i if coin < prob[i] */
+	uint32_t	*alias;	  /* else take this one */
+};
+
+/* Probability mass of each bucket, not normalized.
+ */
+void dist_weights(double *w, dist_t type, double a, double b,
+		  int num_regions, double *access, double *size)
+{
+	unsigned i, n[MAX_REGIONS] = { 0 };
+	double p, cum;
+	int z;
+
+	switch (type) {
+	case DIST_ZIPF:
+		for (i = 0; i < DIST_BUCKETS; i++)
+			w[i] = pow(i + 1, -a);
+		break;
+	case DIST_PARETO:
+		/* offset = span * (1 - u^p), u uniform on [0, 1), so that
+		 * h of the IO goes to the first 1 - h of the span
+		 */
+		p = log(a) / log(1 - a);
+		for (i = 0; i < DIST_BUCKETS; i++)
+			w[DIST_BUCKETS - 1 - i] =
+				pow((i + 1.0) / DIST_BUCKETS, 1 / p) -
+				pow((double) i / DIST_BUCKETS, 1 / p);
+		break;
+	case DIST_NORMAL:
+		for (i = 0; i < DIST_BUCKETS; i++) {
+			double x = ((i + 0.5) / DIST_BUCKETS - a) / b;
+
+			w[i] = exp(-0.5 * x * x);
+		}
+		break;
+	case DIST_REGIONS:
+		for (z = 0, cum = size[0], i = 0; i < DIST_BUCKETS; i++) {
+			while ((i + 0.5) / DIST_BUCKETS > cum &&
+			       z < num_regions - 1)
+				cum += size[++z];
+			n[z]++;
+			w[i] = z;
+		}
+		for (i = 0; i < DIST_BUCKETS; i++) {
+			z = w[i];
+			w[i] = access[z] / n[z];
+		}
+		break;
+	default:
+		for (i = 0; i < DIST_BUCKETS; i++)
+			w[i] = 1;
+		break;
+	}
+}
+
+/* Vose's alias method.
+ */
+struct dist *dist_build(const char *spec, dist_t type, double a, double b,
+			int num_regions, double *access, double *size)
+{
+	struct dist *d;
+	double *w, sum = 0;
+	uint32_t *small, *large;
+	unsigned i, ns = 0, nl = 0;
+
+	d = calloc(1, sizeof(*d));
+	w = malloc(DIST_BUCKETS * sizeof(*w));
+	small = malloc(DIST_BUCKETS * sizeof(*small));
+	large = malloc(DIST_BUCKETS * sizeof(*large));
+	if (d) {
+		d->prob = malloc(DIST_BUCKETS * sizeof(*d->prob));
+		d->alias = malloc(DIST_BUCKETS * sizeof(*d->alias));
+	}
+	if (!d || !w || !small || !large || !d->prob || !d->alias) {
+		if (d) {
+			free(d->prob);
+			free(d->alias);
+		}
+		free(d);
+		d = NULL;
+		goto Out;
+	}
+	d->spec = spec;
+
+	dist_weights(w, type, a, b, num_regions, access, size);
+	for (i = 0; i < DIST_BUCKETS; i++)
+		sum += w[i];
+	for (i = 0; i < DIST_BUCKETS; i++) {
+		w[i] = w[i] * DIST_BUCKETS / sum;
+		if (w[i] < 1)
+			small[ns++] = i;
+		else
+			large[nl++] = i;
+	}
+
+	while (ns > 0 && nl > 0) {
+		uint32_t s = small[--ns], l = large[nl-1];
+
+		d->prob[s] = w[s] * 0x1.0p32;
+		d->alias[s] = l;
+		w[l] -= 1 - w[s];
+		if (w[l] < 1) {
+			nl--;
+			small[ns++] = l;
+		}
+	}
+	/* What's left is 1, up to rounding */
+	while (nl > 0) {
+		i = large[--nl];
+		d->prob[i] = UINT32_MAX;
+		d->alias[i] = i;
+	}
+	while (ns > 0) {
+		i = small[--ns];
+		d->prob[i] = UINT32_MAX;
+		d->alias[i] = i;
+	}
+ Out:
+	free(w);
+	free(small);
+	free(large);
+	return d;
+}
+
+void dist_free(struct dist *d)
+{
+	if (!d)
+		return;
+	free(d->prob);
+	free(d->alias);
+	free(d);
+}
+
+/* A block in [lo, hi] for IO num.
+ */
+static inline unsigned long long dist_blk(struct thread_info *thread,
+					  uint64_t num, unsigned long long lo,
+					  unsigned long long hi)
+{
+	uint64_t r = io_rand(thread, num, RND_BUCKET);
+	uint32_t i = r >> (64 - DIST_SHIFT);
+	unsigned long long n = hi - lo + 1, a, b;
+
+	if ((uint32_t) r >= thread->dist->prob[i])
+		i = thread->dist->alias[i];
+	a = lo + (unsigned long long) (((unsigned __int128) i * n) >>
+				       DIST_SHIFT);
+	b = lo + (unsigned long long) (((unsigned __int128) (i + 1) * n) >>
+				       DIST_SHIFT);
+	if (b > a)
+		b--;
+
+	return rnd_range(io_rand(thread, num, RND_OFFSET), a, b);
+}
+
+/* ---------- Data pattern ---------- */
+
+/* DC data is 8 interleaved xorshift128+ streams, one per 64-bit word
+ * of each 64-byte block, so that a block is one step of all streams.
+ * All implementations produce the same bytes for the same seed.
+ */
+#define PAT_LANES	8
+#define PAT_BLOCK	(PAT_LANES * 8)
+
+struct pattern {
+	uint64_t	s0[PAT_LANES];
+	uint64_t	s1[PAT_LANES];
+};
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static void pattern_init(struct pattern *pat, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < PAT_LANES; i++) {
+		pat->s0[i] = splitmix64(&seed);
+		pat->s1[i] = splitmix64(&seed) | 1;
+	}
+}
+
+/* Fill len bytes, rounded up to PAT_BLOCK.
+ */
+static void pattern_fill_none(void *buf, size_t len, uint64_t seed)
+{
+	struct pattern pat;
+	uint8_t *p = buf;
+	size_t i;
+	int j;
+
+	pattern_init(&pat, seed);
+	for (i = 0; i < len; i += PAT_BLOCK) {
+		for (j = 0; j < PAT_LANES; j++) {
+			uint64_t s1 = pat.s0[j];
+			uint64_t s0 = pat.s1[j];
+			uint64_t r = s0 + s1;
+
+			pat.s0[j] = s0;
+			s1 ^= s1 << 23;
+			pat.s1[j] = s1 ^ s0 ^ (s1 >> 18) ^ (s0 >> 5);
+			memcpy(p + i + j*8, &r, 8);
+		}
+	}
+}
+
+/* The offset of the first byte which differs, or len.
+ */
+static size_t pattern_cmp_none(const void *a, const void *b, size_t len)
+{
+	const uint8_t *x = a, *y = b;
+	size_t i = 0;
+
+	for ( ; i + 8 <= len; i += 8) {
+		uint64_t u, v;
+
+		memcpy(&u, x + i, 8);
+		memcpy(&v, y + i, 8);
+		if (u != v)
+			break;
+	}
+	for ( ; i < len; i++)
+		if (x[i] != y[i])
+			break;
+
+	return i;
+}
+
+#ifdef HAVE_X86_SIMD
+#define XS128P(_S0, _S1, _R, _SHL, _SHR, _XOR, _ADD) do {		\
+		__typeof__(_S0) __s1 = _S0, __s0 = _S1;			\
+		_R = _ADD(__s0, __s1);					\
+		_S0 = __s0;						\
+		__s1 = _XOR(__s1, _SHL(__s1, 23));			\
+		_S1 = _XOR(_XOR(__s1, __s0), _XOR(_SHR(__s1, 18),	\
+						  _SHR(__s0, 5)));	\
+	} while (0)
+
+__attribute__((target("sse2")))
+static void pattern_fill_sse2(void *buf, size_t len, uint64_t seed)
+{
+	struct pattern pat;
+	__m128i s0[4], s1[4], r;
+	uint8_t *p = buf;
+	size_t i;
+	int j;
+
+	pattern_init(&pat, seed);
+	for (j = 0; j < 4; j++) {
+		s0[j] = _mm_loadu_si128((__m128i *) &pat.s0[j*2]);
+		s1[j] = _mm_loadu_si128((__m128i *) &pat.s1[j*2]);
+	}
+	for (i = 0; i < len; i += PAT_BLOCK) {
+		for (j = 0; j < 4; j++) {
+			XS128P(s0[j], s1[j], r, _mm_slli_epi64, _mm_srli_epi64,
+			       _mm_xor_si128, _mm_add_epi64);
+			_mm_storeu_si128((__m128i *) (p + i + j*16), r);
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static size_t pattern_cmp_sse2(const void *a, const void *b, size_t len)
+{
+	const uint8_t *x = a, *y = b;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i u = _mm_loadu_si128((__m128i *) (x + i));
+		__m128i v = _mm_loadu_si128((__m128i *) (y + i));
+		unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(u, v));
+
+		if (m != 0xFFFF)
+			return i + __builtin_ctz(~m);
+	}
+
+	return i + pattern_cmp_none(x + i, y + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void pattern_fill_avx2(void *buf, size_t len, uint64_t seed)
+{
+	struct pattern pat;
+	__m256i s0[2], s1[2], r;
+	uint8_t *p = buf;
+	size_t i;
+	int j;
+
+	pattern_init(&pat, seed);
+	for (j = 0; j < 2; j++) {
+		s0[j] = _mm256_loadu_si256((__m256i *) &pat.s0[j*4]);
+		s1[j] = _mm256_loadu_si256((__m256i *) &pat.s1[j*4]);
+	}
+	for (i = 0; i < len; i += PAT_BLOCK) {
+		for (j = 0; j < 2; j++) {
+			XS128P(s0[j], s1[j], r, _mm256_slli_epi64,
+			       _mm256_srli_epi64, _mm256_xor_si256,
+			       _mm256_add_epi64);
+			_mm256_storeu_si256((__m256i *) (p + i + j*32), r);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static size_t pattern_cmp_avx2(const void *a, const void *b, size_t len)
+{
+	const uint8_t *x = a, *y = b;
+	size_t i;
+
+	for (i = 0; i + 64 <= len; i += 64) {
+		__m256i e0, e1;
+
+		e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *) (x + i)),
+				       _mm256_loadu_si256((__m256i *) (y + i)));
+		e1 = _mm256_cmpeq_epi8(
+			_mm256_loadu_si256((__m256i *) (x + i + 32)),
+			_mm256_loadu_si256((__m256i *) (y + i + 32)));
+		if ((unsigned) _mm256_movemask_epi8(_mm256_and_si256(e0, e1))
+		    != 0xFFFFFFFF) {
+			unsigned m = _mm256_movemask_epi8(e0);
+
+			if (m != 0xFFFFFFFF)
+				return i + __builtin_ctz(~m);
+			m = _mm256_movemask_epi8(e1);
+			return i + 32 + __builtin_ctz(~m);
+		}
+	}
+
+	return i + pattern_cmp_sse2(x + i, y + i, len - i);
+}
+#endif
+
+static void (*pattern_fill)(void *buf, size_t len, uint64_t seed) =
+	pattern_fill_none;
+static size_t (*pattern_cmp)(const void *a, const void *b, size_t len) =
+	pattern_cmp_none;
+
+/* Pick the implementation: one of auto, avx2, sse2 or none.
+ * Return the one picked.
+ */
+const char *pattern_select(const char *simd)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if ((strcmp(simd, "auto") == 0 || strcmp(simd, "avx2") == 0) &&
+	    __builtin_cpu_supports("avx2")) {
+		pattern_fill = pattern_fill_avx2;
+		pattern_cmp = pattern_cmp_avx2;
+		return "avx2";
+	}
+	if ((strcmp(simd, "auto") == 0 || strcmp(simd, "avx2") == 0 ||
+	     strcmp(simd, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+		pattern_fill = pattern_fill_sse2;
+		pattern_cmp = pattern_cmp_sse2;
+		return "sse2";
+	}
+#endif
+	pattern_fill = pattern_fill_none;
+	pattern_cmp = pattern_cmp_none;
+	return "none";
+}
+
+/* ---------- Rate limiting ---------- */
+
+/* Rate limited IO is issued open loop: IO N is due at a time which
+ * depends only on the sizes and arrival intervals of the IOs before
+ * it, not on when they completed. Its latency is measured from when
+ * it was due, so time spent queueing behind a stalled device counts.
+ */
+static inline int rate_limited(struct thread_info *thread)
+{
+	return thread->rate_iops != 0 || thread->rate_bw != 0;
+}
+
+/* The tighter of a per thread and a thread's share of a total limit,
+ * 0 being none.
+ */
+static inline double rate_limit(double rate, double share)
+{
+	if (rate == 0 || (share != 0 && share < rate))
+		return share;
+
+	return rate;
+}
+
+/* Map active time onto wall time: with bursts, IO only arrives
+ * during the on part of each on/off period.
+ */
+static inline uint64_t burst_map(struct thread_info *thread, uint64_t t)
+{
+	uint64_t on = thread->burst_on_ns;
+
+	if (on == 0)
+		return t;
+
+	return t / on * (on + thread->burst_off_ns) + t % on;
+}
+
+/* When io is due.
+ */
+void rate_sched(struct thread_info *thread, struct io_u *io)
+{
+	double gap = 0;
+
+	if (!rate_limited(thread)) {
+		io->sched_ns = 0;
+		return;
+	}
+
+	if (thread->rate_iops)
+		gap = 1e9 / thread->rate_iops;
+	if (thread->rate_bw && io->count * 1e9 / thread->rate_bw > gap)
+		gap = io->count * 1e9 / thread->rate_bw;
+	if (thread->poisson) {
+		uint64_t r = io_rand(thread, io->num, RND_ARRIVAL);
+
+		/* exponential, from a uniform in (0, 1] */
+		gap *= -log(((r >> 11) + 1) * 0x1.0p-53);
+	}
+
+	io->sched_ns = thread->rate_start_ns +
+		burst_map(thread, (uint64_t) thread->rate_t);
+	thread->rate_t += gap;
+}
+
+/* Wait until io is due. Return -1 if the thread has to stop
+ * before then, having waited until it does.
+ */
+int rate_wait(struct thread_info *thread, struct io_u *io)
+{
+	struct timespec ts;
+	uint64_t until = io->sched_ns;
+	int res = 0;
+
+	if (thread->stop_ns && until >= thread->stop_ns) {
+		until = thread->stop_ns;
+		thread->stopping = 1;
+		res = -1;
+	}
+
+	if (until && now_ns() < until) {
+		ts.tv_sec = until / 1000000000ULL;
+		ts.tv_nsec = until % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+	}
+
+	return res;
+}
+
+/* ---------- Run time ---------- */
+
+/* The user and sys CPU time of this IO thread so far, in usec. A child
+ * process counts its IO log flusher too.
+ */
+void thread_cpu(struct thread_info *thread, uint64_t cpu[2])
+{
+	struct rusage ru;
+
+	if (getrusage(thread->pthreads ? RUSAGE_THREAD : RUSAGE_SELF,
+		      &ru) == -1) {
+		cpu[0] = cpu[1] = 0;
+		return;
+	}
+	cpu[0] = ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec;
+	cpu[1] = ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec;
+}
+
+/* Called after IO with a timestamp which the IO path took anyway,
+ * so that a timed run costs no more than a compare per IO. Ends the
+ * ramp once, and returns 1 when it's time to stop issuing IO.
+ */
+static inline int check_deadlines(struct thread_info *thread, uint64_t now)
+{
+	if (thread->ramp_ns && now >= thread->ramp_ns) {
+		thread->ramp_ns = 0;
+		reset_stats(thread->stats);
+		thread_cpu(thread, thread->cpu_base);
+		fprintf(thread->fp, "Ramp done at io: %lu on ", thread->io_num);
+		print_time(thread->fp);
+	}
+	if (thread->stop_ns && now >= thread->stop_ns)
+		thread->stopping = 1;
+
+	return thread->stopping;
+}
+
+#define CONTROL_POLL_MS	10
+
+/* Take up what the parent changed over the control socket.
+ */
+void control_apply(struct thread_info *thread)
+{
+	struct control *ctl = thread->ctl;
+	uint64_t now = now_ns();
+	unsigned active = ctl->num_threads;
+	int paused = thread->paused;
+
+	thread->ctl_gen = __atomic_load_n(&ctl->gen, __ATOMIC_ACQUIRE);
+	if (ctl->set & CTL_ACTIVE && ctl->active < active)
+		active = ctl->active ? ctl->active : 1;
+	if (ctl->set & CTL_RATE && !thread->trace) {
+		thread->rate_iops = (double) ctl->rate_iops / active;
+		thread->rate_bw = 0;
+		thread->rate_start_ns = now;
+		thread->rate_t = 0;
+	}
+	if (ctl->set & CTL_RWMIX)
+		thread->rwmix_read = ctl->rwmix_read;
+	if (ctl->set & CTL_IODEPTH)
+		thread->max_inflight = ctl->iodepth < thread->iodepth ?
+			ctl->iodepth : thread->iodepth;
+	thread->paused = ctl->paused || thread->index >= active;
+	if (ctl->stop)
+		thread->stopping = 1;
+
+	if (paused != thread->paused) {
+		fprintf(thread->fp, "%s at io: %lu on ", thread->paused ?
+			"Paused" : "Resumed", thread->io_num);
+		print_time(thread->fp);
+		/* don't catch up on the IO not done meanwhile, unless
+		 * replaying a trace, which keeps to its time line */
+		if (!thread->trace) {
+			thread->rate_start_ns = now;
+			thread->rate_t = 0;
+		}
+	}
+}
+
+/* Without a syscall unless something changed. Return 1 to stop.
+ */
+static inline int control_check(struct thread_info *thread)
+{
+	if (thread->ctl && __atomic_load_n(&thread->ctl->gen,
+					   __ATOMIC_RELAXED) != thread->ctl_gen)
+		control_apply(thread);
+
+	return thread->stopping;
+}
+
+/* Sleep while paused. Return 1 to stop.
+ */
+int control_wait(struct thread_info *thread)
+{
+	struct timespec ts = { 0, CONTROL_POLL_MS * 1000000L };
+
+	while (thread->paused && !thread->stopping) {
+		nanosleep(&ts, NULL);
+		check_deadlines(thread, now_ns());
+		control_check(thread);
+	}
+
+	return thread->stopping;
+}
+
+/* ---------- Trace replay ---------- */
+
+struct trace {
+	struct trace_rec *recs;
+	uint64_t	len;
+	uint64_t	alloc;
+	unsigned	num_devs;	/* seen in blkparse output */
+	dev_t		devs[256];
+};
+
+int trace_add(struct trace *tr, struct trace_rec *rec)
+{
+	if (tr->len == tr->alloc) {
+		uint64_t alloc = tr->alloc ? tr->alloc * 2 : 4096;
+		struct trace_rec *recs;
+
+		recs = realloc(tr->recs, alloc * sizeof(*recs));
+		if (!recs)
+			return -1;
+		tr->recs = recs;
+		tr->alloc = alloc;
+	}
+	tr->recs[tr->len++] = *rec;
+
+	return 0;
+}
+
+/* Devices are numbered in the order they first appear.
+ */
+uint16_t trace_dev(struct trace *tr, unsigned maj, unsigned min)
+{
+	dev_t dev = makedev(maj, min);
+	unsigned i;
+
+	for (i = 0; i < tr->num_devs; i++)
+		if (tr->devs[i] == dev)
+			return i;
+	if (tr->num_devs < sizeof(tr->devs)/sizeof(tr->devs[0]))
+		tr->devs[tr->num_devs++] = dev;
+
+	return i;
+}
+
+/* Take the Q (queued) events of default format blkparse output,
+ *   8,0  3  1  0.000000000  697  Q  WS 3417048 + 8 [kworker/3:1H]
+ * reads and writes only.
+ */
+int trace_read_blkparse(struct trace *tr, FILE *f)
+{
+	char line[512], act[4], rwbs[8];
+	unsigned maj, min, n;
+	unsigned long long sector;
+	struct trace_rec rec;
+	double t;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%u,%u %*u %*u %lf %*u %3s %7s %llu + %u",
+			   &maj, &min, &t, act, rwbs, &sector, &n) != 7)
+			continue;
+		if (strcmp(act, "Q") || n == 0)
+			continue;
+		if (strchr(rwbs, 'W'))
+			rec.op = WRITE;
+		else if (strchr(rwbs, 'R'))
+			rec.op = READ;
+		else
+			continue;
+		rec.ts_ns = t * 1e9;
+		rec.offset = sector * 512;
+		rec.count = n * 512;
+		rec.dev = trace_dev(tr, maj, min);
+		if (trace_add(tr, &rec))
+			return -1;
+	}
+
+	return 0;
+}
+
+int trace_read_binary(struct trace *tr, FILE *f)
+{
+	struct trace_rec rec;
+	uint32_t version;
+
+	if (fread(&version, sizeof(version), 1, f) != 1 ||
+	    le32toh(version) != TRACE_VERSION)
+		return -1;
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		rec.ts_ns = le64toh(rec.ts_ns);
+		rec.offset = le64toh(rec.offset);
+		rec.count = le32toh(rec.count);
+		rec.op = le16toh(rec.op);
+		rec.dev = le16toh(rec.dev);
+		if (rec.count == 0 || (rec.op != READ && rec.op != WRITE))
+			continue;
+		if (trace_add(tr, &rec))
+			return -1;
+	}
+
+	return ferror(f) ? -1 : 0;
+}
+
+/* Read a trace, blkparse text or binary, with times made relative
+ * to its first record.
+ */
+int trace_load(const char *name, struct trace *tr)
+{
+	char magic[4];
+	uint64_t i, t0;
+	FILE *f;
+	int res;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Couldn't open %s: %s\n", name,
+			strerror(errno));
+		return -1;
+	}
+
+	memset(tr, 0, sizeof(*tr));
+	if (fread(magic, sizeof(magic), 1, f) == 1 &&
+	    memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+		res = trace_read_binary(tr, f);
+	} else {
+		rewind(f);
+		res = trace_read_blkparse(tr, f);
+	}
+	fclose(f);
+	if (res) {
+		fprintf(stderr, "Couldn't read trace %s\n", name);
+		free(tr->recs);
+		return -1;
+	}
+	if (tr->len == 0) {
+		fprintf(stderr, "No reads or writes in trace %s\n", name);
+		return -1;
+	}
+
+	t0 = tr->recs[0].ts_ns;
+	for (i = 0; i < tr->len; i++)
+		tr->recs[i].ts_ns = tr->recs[i].ts_ns > t0 ?
+			tr->recs[i].ts_ns - t0 : 0;
+
+	return 0;
+}
+
+/* Deal the records of each device round robin to the threads doing
+ * IO to it, thread i doing IO to device i % num_devices. A trace
+ * device without a thread goes to that of device dev % num_threads.
+ */
+int trace_split(struct trace *tr, struct thread_info *thread,
+		int num_threads, int num_devices)
+{
+	unsigned nd = num_devices < num_threads ? num_devices : num_threads;
+	uint64_t *next, i;
+	int t;
+
+	next = calloc(nd, sizeof(*next));
+	if (!next)
+		return -1;
+
+	for (i = 0; i < tr->len; i++) {
+		unsigned d = tr->recs[i].dev % nd;
+		unsigned w = (num_threads - d + num_devices - 1) / num_devices;
+
+		t = d + next[d]++ % w * num_devices;
+		thread[t].trace_len++;
+	}
+	for (t = 0; t < num_threads; t++) {
+		thread[t].trace = malloc((thread[t].trace_len + 1) *
+					 sizeof(struct trace_rec));
+		if (!thread[t].trace) {
+			free(next);
+			return -1;
+		}
+		thread[t].trace_len = 0;
+	}
+	memset(next, 0, nd * sizeof(*next));
+	for (i = 0; i < tr->len; i++) {
+		unsigned d = tr->recs[i].dev % nd;
+		unsigned w = (num_threads - d + num_devices - 1) / num_devices;
+
+		t = d + next[d]++ % w * num_devices;
+		thread[t].trace[thread[t].trace_len++] = tr->recs[i];
+	}
+	free(next);
+
+	return 0;
+}
+
+/* What a thread replaying its records does instead of what the
+ * options say: their number, ops and sizes.
+ */
+void replay_setup(struct thread_info *thread, double speed)
+{
+	uint64_t i, left = 0;
+	int writes = 0;
+
+	thread->replay_speed = speed;
+	thread->max_io = 0;
+	for (i = 0; i < thread->trace_len; i++) {
+		if (thread->trace[i].count > thread->max_io)
+			thread->max_io = thread->trace[i].count;
+		writes |= thread->trace[i].op == WRITE;
+	}
+	if (thread->max_io == 0)
+		thread->max_io = MIN_IO_DEFAULT;
+	thread->op = writes ? RW : READ;
+	thread->fixed = 0;
+	thread->bssplit = NULL;
+	thread->seq = 0;
+
+	if (thread->io_num < thread->trace_len) {
+		left = thread->trace_len - thread->io_num;
+		thread->trace_ts_ns = thread->trace[thread->io_num].ts_ns;
+	}
+	if (thread->num_ios == -1 || thread->num_ios > left)
+		thread->num_ios = left;
+}
+
+/* Make io that of trace record io->num. Records which don't fit
+ * the span are wrapped into it, and all are aligned. Its original
+ * time past that of the first record replayed, scaled, is when it's
+ * due.
+ */
+void trace_io(struct thread_info *thread, struct io_u *io)
+{
+	struct trace_rec *rec = &thread->trace[io->num];
+	unsigned long long a = thread->align;
+	unsigned long long base = thread->min_span_blk * a;
+	unsigned long long span = thread->max_span - base;
+
+	io->rw = rec->op;
+	io->count = (rec->count + a - 1) / a * a;
+	if (io->count > thread->buf_size)
+		io->count = thread->buf_size / a * a;
+	if (io->count > span)
+		io->count = span / a * a;
+	io->start = rec->offset / a * a;
+	if (io->start < base || io->start + io->count > thread->max_span)
+		io->start = base + rec->offset % (span - io->count + 1) /
+			a * a;
+	io->phase = 0;
+	if (thread->replay_speed)
+		io->sched_ns = thread->rate_start_ns +
+			(uint64_t) ((rec->ts_ns > thread->trace_ts_ns ?
+				     rec->ts_ns - thread->trace_ts_ns : 0) /
+				    thread->replay_speed);
+	else
+		io->sched_ns = 0;
+}
+
+/* Account how late a replayed io was issued at now.
+ */
+static inline void account_drift(struct thread_info *thread,
+				 struct io_u *io, uint64_t now)
+{
+	if (thread->trace && io->sched_ns)
+		lat_add(&thread->stats->drift,
+			now > io->sched_ns ? now - io->sched_ns : 0);
+}
+
+/* Account a completed IO of the given type which took ns.
+ */
+static inline void account_io(struct thread_stats *st, lat_t type,
+			      uint64_t bytes, uint64_t ns)
+{
+	switch (type) {
+	case LAT_READ:
+		STAT_ADD(st->bytes_read, bytes);
+		STAT_ADD(st->read_iops, 1);
+		break;
+	case LAT_WRITE:
+		STAT_ADD(st->bytes_written, bytes);
+		STAT_ADD(st->write_iops, 1);
+		break;
+	case LAT_COPY:
+		STAT_ADD(st->bytes_copied, bytes);
+		break;
+	default:
+		break;
+	}
+	lat_add(&st->lat[type], ns);
+}
+
+/* ---------- IO log ---------- */
+
+/* With --io-log, each IO is logged as one of these into a ring which
+ * a flusher pthread empties into /tmp/iogen_thread.<tid>.iolog, so
+ * that the IO path only copies 48 bytes. The file starts with a
+ * header the size of a record. --decode-log prints it as text.
+ */
+#define IO_LOG_MAGIC	"IOGL"
+#define IO_LOG_VERSION	1
+#define IO_LOG_VALID	1	  /* unwritten, zeroed, records aren't */
+#define IO_LOG_RING	65536	  /* records, a power of 2 */
+#define IO_LOG_WINDOW	262144	  /* records mapped at once */
+
+struct io_log_rec {
+	uint64_t	ts_ns;	  /* CLOCK_MONOTONIC, when it was logged */
+	uint64_t	num;
+	uint64_t	offset;
+	uint64_t	lat_ns;
+	uint32_t	count;
+	int32_t		res;
+	uint16_t	op;
+	uint16_t	err;	  /* errno */
+	uint32_t	flags;
+};
+
+struct io_log_hdr {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	rec_size;
+	uint32_t	tid;
+	uint8_t		pad[32];
+};
+
+struct io_log {
+	struct io_log_rec *ring;
+	uint64_t	head __attribute__((aligned(64)));  /* IO thread's */
+	uint64_t	tail __attribute__((aligned(64)));  /* flusher's */
+	uint64_t	waits;	  /* for a full ring */
+	uint64_t	dropped;  /* records, after the flusher failed */
+	int		stop;
+	int		error;	  /* errno the flusher failed with, or 0 */
+
+	int		fd;
+	struct io_log_rec *map;	  /* window of the file */
+	uint64_t	map_first;  /* first record in the window */
+	uint64_t	written;    /* records */
+	pthread_t	flusher;
+	char		name[255];
+};
+
+_Static_assert(sizeof(struct io_log_rec) == 48, "io log record size");
+_Static_assert(sizeof(struct io_log_hdr) == sizeof(struct io_log_rec),
+	       "io log header size");
+
+/* Called by the IO thread only. Waits rather than drop a record
+ * when the flusher falls behind, but drops it once the flusher failed.
+ */
+static inline void io_log_put(struct io_log *log, struct io_log_rec *rec)
+{
+	uint64_t head = log->head;
+
+	while (head - __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE) >=
+	       IO_LOG_RING) {
+		if (__atomic_load_n(&log->error, __ATOMIC_ACQUIRE)) {
+			log->dropped++;
+			return;
+		}
+		log->waits++;
+		sched_yield();
+	}
+	log->ring[head & (IO_LOG_RING - 1)] = *rec;
+	__atomic_store_n(&log->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Map the window of the file holding record n, growing the file.
+ * Record n is at n+1, after the header.
+ */
+int io_log_map(struct io_log *log, uint64_t n)
+{
+	size_t len = IO_LOG_WINDOW * sizeof(struct io_log_rec);
+	off_t off = (n + 1) / IO_LOG_WINDOW * len;
+
+	if (log->map)
+		munmap(log->map, len);
+	log->map = NULL;
+	if (ftruncate(log->fd, off + len) == -1)
+		return -1;
+	log->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			log->fd, off);
+	if (log->map == MAP_FAILED) {
+		log->map = NULL;
+		return -1;
+	}
+	log->map_first = (n + 1) / IO_LOG_WINDOW * IO_LOG_WINDOW;
+
+	return 0;
+}
+
+void *io_log_flusher(void *arg)
+{
+	struct io_log *log = arg;
+	struct timespec ts = { 0, 1000000 };
+	uint64_t head, tail = log->tail;
+	int stop;
+
+	do {
+		stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (!stop)
+				nanosleep(&ts, NULL);
+			continue;
+		}
+		for ( ; tail != head; tail++) {
+			uint64_t n = log->written + 1;
+
+			if (!log->map || n - log->map_first >= IO_LOG_WINDOW) {
+				if (io_log_map(log, log->written)) {
+					__atomic_store_n(&log->tail, tail,
+							 __ATOMIC_RELEASE);
+					__atomic_store_n(&log->error,
+							 errno ? errno : EIO,
+							 __ATOMIC_RELEASE);
+					return (void *) -1L;
+				}
+			}
+			log->map[n - log->map_first] =
+				log->ring[tail & (IO_LOG_RING - 1)];
+			log->written++;
+		}
+		__atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+	} while (!stop || head != tail);
+
+	return NULL;
+}
+
+int io_log_start(struct thread_info *thread)
+{
+	struct io_log *log;
+	struct io_log_hdr hdr = { IO_LOG_MAGIC, IO_LOG_VERSION,
+				  sizeof(struct io_log_rec), thread->tid };
+
+	log = calloc(1, sizeof(*log));
+	if (!log)
+		return -1;
+	log->ring = calloc(IO_LOG_RING, sizeof(*log->ring));
+	sprintf(log->name, "/tmp/iogen_thread.%d.iolog", thread->tid);
+	log->fd = open(log->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (!log->ring || log->fd == -1 ||
+	    write(log->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		fprintf(thread->fp, "Couldn't create %s: %s\n", log->name,
+			strerror(errno));
+		goto Err;
+	}
+	errno = pthread_create(&log->flusher, NULL, io_log_flusher, log);
+	if (errno) {
+		fprintf(thread->fp, "Couldn't start the IO log flusher: %s\n",
+			strerror(errno));
+		goto Err;
+	}
+	thread->iolog = log;
+
+	return 0;
+ Err:
+	if (log->fd != -1)
+		close(log->fd);
+	free(log->ring);
+	free(log);
+	return -1;
+}
+
+/* Flush what's left and trim the file to the records written.
+ */
+void io_log_stop(struct thread_info *thread)
+{
+	struct io_log *log = thread->iolog;
+
+	if (!log)
+		return;
+	__atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(log->flusher, NULL);
+	if (log->error)
+		fprintf(thread->fp, "Couldn't write %s: %s, dropped %lu "
+			"records\n", log->name, strerror(log->error),
+			log->dropped + log->head - log->tail);
+	if (log->map)
+		munmap(log->map, IO_LOG_WINDOW * sizeof(struct io_log_rec));
+	if (ftruncate(log->fd, (log->written + 1) *
+		      sizeof(struct io_log_rec)) == -1)
+		fprintf(thread->fp, "Couldn't trim %s: %s\n", log->name,
+			strerror(errno));
+	close(log->fd);
+	fprintf(thread->fp, "IO log: %s: %lu records, waited for the "
+		"flusher %lu times\n", log->name, log->written, log->waits);
+	free(log->ring);
+	free(log);
+	thread->iolog = NULL;
+}
+
+void print_io_log(FILE *out, uint16_t op, uint64_t num, uint64_t offset,
+		  uint64_t count, int err)
+{
+	fprintf(out, "op: %-5s io: %10lu offs: %16lu count: %6lu "
+		"errno: %d: %s\n",
+		op2str[op], num, offset, count, err, strerror(err));
+}
+
+/* Print a binary IO log in the text format of the thread log.
+ */
+int io_log_decode(const char *name, FILE *out)
+{
+	struct io_log_hdr hdr;
+	struct io_log_rec rec;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Couldn't open %s: %s\n", name,
+			strerror(errno));
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, IO_LOG_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != IO_LOG_VERSION || hdr.rec_size != sizeof(rec)) {
+		fprintf(stderr, "%s isn't an iogen IO log\n", name);
+		fclose(f);
+		return -1;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1 &&
+	       (rec.flags & IO_LOG_VALID)) {
+		if (rec.op > RENAME)
+			continue;
+		print_io_log(out, rec.op, rec.num, rec.offset, rec.count,
+			     rec.err);
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/* Log io, which returned res at now. Failed IO is also printed
+ * to the thread log.
+ */
+void log_io(struct thread_info *thread, struct io_u *io, int res,
+	    uint64_t now)
+{
+	if (thread->iolog) {
+		struct io_log_rec rec = {
+			.ts_ns = now,
+			.num = io->num,
+			.offset = io->start,
+			.lat_ns = now > io->start_ns ? now - io->start_ns : 0,
+			.count = io->count,
+			.res = res,
+			.op = io->rw,
+			.err = errno,
+			.flags = IO_LOG_VALID,
+		};
+
+		io_log_put(thread->iolog, &rec);
+	}
+	if (res < 0)
+		print_io_log(thread->fp, io->rw, io->num, io->start,
+			     io->count, errno);
+}
+
+/* ---------- Sequential layouts ---------- */
+
+/* Find this thread's share of the span: all of it, a slice of it,
+ * or every seq_peers-th chunk of seq_stride bytes of it, seq_rank
+ * being the first.
+ */
+int seq_setup(struct thread_info *thread)
+{
+	unsigned long long a = thread->align, len, io;
+
+	thread->seq_lo = thread->min_span_blk * a;
+	thread->seq_hi = thread->max_span / a * a;
+	io = thread->fixed ? thread->fixed : thread->max_blk * a;
+	if (thread->bssplit)
+		io = thread->max_io;
+
+	if (thread->seq_skip % a) {
+		fprintf(thread->fp, "Seq skip %llu isn't a multiple of the "
+			"alignment %llu\n", thread->seq_skip, a);
+		return -1;
+	}
+	if (thread->seq_layout == SEQ_STRIDE &&
+	    (thread->seq_stride % a || thread->seq_stride < io)) {
+		fprintf(thread->fp, "Stride %llu isn't a multiple of the "
+			"alignment %llu, or is less than the IO size %llu\n",
+			thread->seq_stride, a, io);
+		return -1;
+	}
+
+	if (thread->seq_hi > thread->seq_lo &&
+	    thread->seq_layout == SEQ_PARTITION) {
+		len = (thread->seq_hi - thread->seq_lo) / a /
+			thread->seq_peers * a;
+		thread->seq_lo += thread->seq_rank * len;
+		if (thread->seq_rank + 1 < thread->seq_peers)
+			thread->seq_hi = thread->seq_lo + len;
+	}
+	if (thread->seq_hi < thread->seq_lo + io) {
+		fprintf(thread->fp, "Sequential span %llu-%llu is smaller "
+			"than the IO size %llu\n", thread->seq_lo,
+			thread->seq_hi, io);
+		return -1;
+	}
+	fprintf(thread->fp, "Seq layout: %s, thread %u of %u, span: "
+		"%llu-%llu\n", seq2str[thread->seq_layout], thread->seq_rank,
+		thread->seq_peers, thread->seq_lo, thread->seq_hi);
+
+	if (thread->seq_layout == SEQ_STRIDE) {
+		thread->seq_step = thread->seq_stride * thread->seq_peers;
+		thread->seq_first = thread->seq_lo +
+			thread->seq_stride * thread->seq_rank;
+		if (thread->seq_first + io > thread->seq_hi)
+			thread->seq_first = thread->seq_lo;
+	} else {
+		thread->seq_stride = thread->seq_hi - thread->seq_lo;
+		thread->seq_step = thread->seq_stride;
+		thread->seq_first = thread->seq_lo;
+	}
+
+	return 0;
+}
+
+static inline unsigned long long seq_chunk_end(struct thread_info *thread,
+						unsigned long long chunk)
+{
+	return thread->seq_hi - chunk < thread->seq_stride ?
+		thread->seq_hi : chunk + thread->seq_stride;
+}
+
+/* Go back to the first IO, at the start of the first chunk, or at the
+ * end of the last one when reversed.
+ */
+void seq_reset(struct thread_info *thread)
+{
+	thread->seq_chunk = thread->seq_first;
+	if (thread->seq_reverse) {
+		thread->seq_chunk += (thread->seq_hi - thread->seq_first - 1) /
+			thread->seq_step * thread->seq_step;
+		thread->last_end = seq_chunk_end(thread, thread->seq_chunk);
+	} else {
+		thread->last_end = thread->seq_chunk;
+	}
+}
+
+/* The offset of the next sequential IO of count bytes. An IO which
+ * doesn't fit in what's left of its chunk goes to the next chunk,
+ * and past the last one it wraps around to the first.
+ */
+unsigned long long seq_next(struct thread_info *thread, size_t count)
+{
+	unsigned long long start;
+
+	if (!thread->seq_reverse) {
+		if (thread->last_end + count >
+		    seq_chunk_end(thread, thread->seq_chunk)) {
+			thread->seq_chunk += thread->seq_step;
+			if (thread->seq_chunk >= thread->seq_hi ||
+			    thread->seq_chunk + count >
+			    seq_chunk_end(thread, thread->seq_chunk))
+				thread->seq_chunk = thread->seq_first;
+			thread->last_end = thread->seq_chunk;
+		}
+		start = thread->last_end;
+		thread->last_end = start + count + thread->seq_skip;
+		return start;
+	}
+
+	while (thread->last_end < thread->seq_chunk + count) {
+		if (thread->seq_chunk < thread->seq_first + thread->seq_step)
+			thread->seq_chunk = thread->seq_first +
+				(thread->seq_hi - thread->seq_first - 1) /
+				thread->seq_step * thread->seq_step;
+		else
+			thread->seq_chunk -= thread->seq_step;
+		thread->last_end = seq_chunk_end(thread, thread->seq_chunk);
+	}
+	start = thread->last_end - count;
+	thread->last_end = start > thread->seq_skip ?
+		start - thread->seq_skip : 0;
+
+	return start;
+}
+
+/* ---------- Zoned devices ---------- */
+
+#define ZONE_REPORT		128	/* zones per BLKREPORTZONE */
+
+static inline unsigned long long zone_wp(struct blk_zone *bz)
+{
+	if (bz->cond == BLK_ZONE_COND_EMPTY)
+		return bz->start << 9;
+	else if (bz->cond == BLK_ZONE_COND_FULL)
+		return (bz->start + bz->len) << 9;
+
+	return bz->wp << 9;
+}
+
+static inline unsigned long long zone_cap(struct blk_zone_report *rep,
+					  struct blk_zone *bz)
+{
+	return (rep->flags & BLK_ZONE_REP_CAPACITY ? bz->capacity :
+		bz->len) << 9;
+}
+
+/* Reset or finish zone z.
+ */
+int zone_op(struct thread_info *thread, struct zone *z, op_t op)
+{
+	struct blk_zone_range range = {
+		.sector = z->start >> 9,
+		.nr_sectors = z->len >> 9,
+	};
+	struct io_u _io, *io = &_io;
+	uint64_t now;
+	int res;
+
+	io->num = thread->io_num;
+	io->rw = op;
+	io->start = z->start;
+	io->count = z->len;
+	io->start_ns = now_ns();
+	res = ioctl(thread->fd, op == RESET ? BLKRESETZONE : BLKFINISHZONE,
+		    &range);
+	now = now_ns();
+	if (res == 0) {
+		account_io(thread->stats, op2lat[op], 0, now - io->start_ns);
+		z->wp = op == RESET ? z->start : z->start + z->cap;
+	}
+	thread->last_ns = now;
+
+	if (thread->io_log || res == -1)
+		log_io(thread, io, res, now);
+
+	return res;
+}
+
+/* Read back the write pointer of z, after a write to it which
+ * failed or fell short.
+ */
+void zone_sync(struct thread_info *thread, struct zone *z)
+{
+	struct {
+		struct blk_zone_report rep;
+		struct blk_zone zone;
+	} r = { .rep = { .sector = z->start >> 9, .nr_zones = 1 } };
+
+	if (ioctl(thread->fd, BLKREPORTZONE, &r) == -1 ||
+	    r.rep.nr_zones != 1) {
+		fprintf(thread->fp, "Couldn't report the zone at %llu: %s\n",
+			z->start, strerror(errno));
+		return;
+	}
+	z->wp = zone_wp(&r.zone);
+	if (z->wp > z->start + z->cap)
+		z->wp = z->start + z->cap;
+}
+
+/* Put the next of the thread's zones which isn't open into the open
+ * slot, instead of the one there, if any. A zone with no room left
+ * is reset, one written part way is written on from where it is.
+ */
+int zone_open(struct thread_info *thread, unsigned slot)
+{
+	struct zone *z;
+
+	if (slot < thread->num_open)
+		thread->zones[thread->open_zones[slot]].open = 0;
+	do {
+		thread->next_zone %= thread->num_zones;
+		z = &thread->zones[thread->next_zone++];
+	} while (z->open);
+
+	if (z->start + z->cap - z->wp < thread->zone_min &&
+	    zone_op(thread, z, RESET))
+		return -1;
+	z->open = 1;
+	thread->open_zones[slot] = z - thread->zones;
+
+	return 0;
+}
+
+/* Find the zones of the device within the span, and deal them out to
+ * its threads, as seq_setup() deals out chunks, then open the first
+ * max_open_zones of them. Each open zone takes one write at a time,
+ * so a thread with fewer zones than its iodepth keeps no more IO in
+ * flight than it has open zones.
+ */
+int zone_setup(struct thread_info *thread)
+{
+	unsigned long long sector = thread->min_span_blk * thread->align >> 9;
+	struct blk_zone_report *rep;
+	unsigned i, n = 0, size = 0;
+	struct blk_zone *bz;
+	struct zone *z;
+
+	rep = malloc(sizeof(*rep) + ZONE_REPORT * sizeof(*bz));
+	if (!rep) {
+		fprintf(thread->fp, "Out of memory for the zone report\n");
+		return -1;
+	}
+
+	for (;;) {
+		rep->sector = sector;
+		rep->nr_zones = ZONE_REPORT;
+		if (ioctl(thread->fd, BLKREPORTZONE, rep) == -1) {
+			fprintf(thread->fp, "Couldn't report the zones of %s: "
+				"%s\n", thread->device, strerror(errno));
+			goto Fail;
+		}
+		if (rep->nr_zones == 0)
+			break;
+
+		for (i = 0; i < rep->nr_zones; i++) {
+			bz = &rep->zones[i];
+			sector = bz->start + bz->len;
+			if (sector << 9 > thread->max_span)
+				break;
+			if (bz->type == BLK_ZONE_TYPE_CONVENTIONAL ||
+			    bz->cond == BLK_ZONE_COND_READONLY ||
+			    bz->cond == BLK_ZONE_COND_OFFLINE ||
+			    n++ % thread->seq_peers != thread->seq_rank)
+				continue;
+
+			if (thread->num_zones == size) {
+				size = size ? 2 * size : ZONE_REPORT;
+				z = realloc(thread->zones, size * sizeof(*z));
+				if (!z) {
+					fprintf(thread->fp, "Out of memory "
+						"for %u zones\n", size);
+					goto Fail;
+				}
+				thread->zones = z;
+			}
+			z = &thread->zones[thread->num_zones++];
+			z->start = bz->start << 9;
+			z->len = bz->len << 9;
+			z->cap = zone_cap(rep, bz);
+			z->wp = zone_wp(bz);
+			z->open = 0;
+			z->busy = 0;
+		}
+		if (i < rep->nr_zones)
+			break;
+	}
+	free(rep);
+
+	if (thread->num_zones == 0) {
+		fprintf(thread->fp, "No sequential zones of %s within the "
+			"span for this thread\n", thread->device);
+		return -1;
+	}
+
+	thread->zone_min = thread->fixed ? thread->fixed :
+		thread->min_blk * thread->align;
+	if (thread->zone_min > thread->zones[0].cap) {
+		fprintf(thread->fp, "IOs of %llu bytes don't fit in zones "
+			"of %llu\n", thread->zone_min, thread->zones[0].cap);
+		return -1;
+	}
+
+	thread->num_open = 0;
+	n = thread->max_open_zones < thread->num_zones ?
+		thread->max_open_zones : thread->num_zones;
+	thread->open_zones = malloc(n * sizeof(*thread->open_zones));
+	if (!thread->open_zones) {
+		fprintf(thread->fp, "Out of memory for %u open zones\n", n);
+		return -1;
+	}
+	for ( ; thread->num_open < n; thread->num_open++)
+		if (zone_open(thread, thread->num_open))
+			return -1;
+
+	fprintf(thread->fp, "Zones: %u of %llu bytes, capacity %llu, "
+		"%u open\n", thread->num_zones, thread->zones[0].len,
+		thread->zones[0].cap, thread->num_open);
+	if (thread->iodepth > thread->num_open) {
+		thread->iodepth = thread->num_open;
+		thread->max_inflight = thread->num_open;
+		fprintf(thread->fp, "IO depth: %u, one per open zone\n",
+			thread->iodepth);
+	}
+
+	return 0;
+ Fail:
+	free(rep);
+	return -1;
+}
+
+void zone_free(struct thread_info *thread)
+{
+	free(thread->zones);
+	free(thread->open_zones);
+	thread->zones = NULL;
+	thread->open_zones = NULL;
+}
+
+/* Put the write at the write pointer of the next open zone which
+ * has no write in flight, cut to what's left of the zone. A zone
+ * with less left than the smallest IO is finished, and the next
+ * zone opened in its place.
+ */
+int zone_write(struct thread_info *thread, struct io_u *io)
+{
+	unsigned long long left;
+	unsigned i, slot;
+	struct zone *z;
+
+	for (i = 0; i < thread->num_open; i++) {
+		slot = thread->zone_cur++ % thread->num_open;
+		z = &thread->zones[thread->open_zones[slot]];
+		if (z->busy)
+			continue;
+
+		left = z->start + z->cap - z->wp;
+		if (left < thread->zone_min) {
+			if ((left && zone_op(thread, z, FINISH)) ||
+			    zone_open(thread, slot))
+				return -1;
+			z = &thread->zones[thread->open_zones[slot]];
+			left = z->start + z->cap - z->wp;
+		}
+
+		io->start = z->wp;
+		if (io->count > left)
+			io->count = left / thread->align * thread->align;
+		io->zone = z;
+		z->wp += io->count;
+		z->busy = 1;
+		return 0;
+	}
+
+	fprintf(thread->fp, "All %u open zones are being written, see "
+		"--max-open-zones\n", thread->num_open);
+	return -1;
+}
+
+/* The write to io->zone is done, with res bytes written or -1.
+ */
+static inline void zone_done(struct thread_info *thread, struct io_u *io,
+			     ssize_t res)
+{
+	io->zone->busy = 0;
+	if (res != (ssize_t) io->count)
+		zone_sync(thread, io->zone);
+}
+
+/* ---------- Filesystem mode ---------- */
+
+#define FS_DIR_FILES		256	/* files per directory */
+#define FS_LAYOUT_BUF		(1024*1024)
+
+/* File i is d<i % fs_dirs>/f<i>, renamed to d<i+1 % fs_dirs>/f<i>.r
+ * and back.
+ */
+static inline void fs_path(struct thread_info *thread, unsigned i,
+			   int renamed, char *path, size_t len)
+{
+	snprintf(path, len, "d%u/f%u%s", (i + renamed) % thread->fs_dirs, i,
+		 renamed ? ".r" : "");
+}
+
+static inline op_t meta_op(struct thread_info *thread, unsigned r)
+{
+	if (r < thread->stat_pct)
+		return STAT;
+	r -= thread->stat_pct;
+	if (r < thread->create_pct)
+		return CREATE;
+	r -= thread->create_pct;
+
+	return r < thread->unlink_pct ? UNLINK : RENAME;
+}
+
+static inline void fs_lru_del(struct thread_info *thread, int i)
+{
+	struct fs_file *f = &thread->fs[i];
+
+	if (f->prev == -1)
+		thread->fs_head = f->next;
+	else
+		thread->fs[f->prev].next = f->next;
+	if (f->next == -1)
+		thread->fs_tail = f->prev;
+	else
+		thread->fs[f->next].prev = f->prev;
+}
+
+static inline void fs_lru_add(struct thread_info *thread, int i)
+{
+	struct fs_file *f = &thread->fs[i];
+
+	f->prev = -1;
+	f->next = thread->fs_head;
+	if (thread->fs_head == -1)
+		thread->fs_tail = i;
+	else
+		thread->fs[thread->fs_head].prev = i;
+	thread->fs_head = i;
+}
+
+/* Close file i, if it's in the fd cache.
+ */
+void fs_evict(struct thread_info *thread, int i)
+{
+	struct fs_file *f = &thread->fs[i];
+
+	if (f->fd == -1)
+		return;
+	if (thread->fd == f->fd)
+		thread->fd = thread->fs_dir;
+	close(f->fd);
+	f->fd = -1;
+	fs_lru_del(thread, i);
+	thread->fs_cached--;
+}
+
+/* Make the file of the data IO io thread->fd, opening it, and
+ * creating it if it was unlinked, unless it's in the fd cache.
+ */
+int fs_open(struct thread_info *thread, struct io_u *io)
+{
+	struct fs_file *f = &thread->fs[io->file];
+	struct io_u _op, *op = &_op;
+	char path[64];
+	uint64_t now;
+	int fd;
+
+	if (io->rw >= OPEN)
+		return 0;
+	if (f->fd != -1) {
+		if (thread->fs_head != (int) io->file) {
+			fs_lru_del(thread, io->file);
+			fs_lru_add(thread, io->file);
+		}
+		thread->fd = f->fd;
+		return 0;
+	}
+	if (thread->fs_cached == thread->fd_cache)
+		fs_evict(thread, thread->fs_tail);
+
+	op->num = io->num;
+	op->rw = OPEN;
+	op->start = io->file;
+	op->count = 0;
+	fs_path(thread, io->file, f->renamed, path, sizeof(path));
+	op->start_ns = now_ns();
+	fd = openat(thread->fs_dir, path, O_CREAT | thread->open_flags, 0644);
+	now = now_ns();
+	if (fd != -1)
+		account_io(thread->stats, LAT_OPEN, 0, now - op->start_ns);
+	if (thread->io_log || fd == -1)
+		log_io(thread, op, fd == -1 ? -1 : 0, now);
+	if (fd == -1)
+		return -1;
+
+	f->exists = 1;
+	f->fd = fd;
+	fs_lru_add(thread, io->file);
+	thread->fs_cached++;
+	thread->fd = fd;
+
+	return 0;
+}
+
+/* The first file from i on which exists, and has data if data is
+ * set, -1 if there's none.
+ */
+static int fs_find(struct thread_info *thread, unsigned i, int exists,
+		   int data)
+{
+	unsigned n;
+
+	for (n = 0; n < thread->files; n++, i = (i + 1) % thread->files)
+		if (thread->fs[i].exists == exists &&
+		    (!data || thread->fs[i].size >= thread->align))
+			return i;
+
+	return -1;
+}
+
+/* Pick the file of io, and its offset in it. Reads, discards and
+ * zeroes go to a file with data, within what was written of it, or
+ * become writes if there's none. Writes extend a file which isn't
+ * as big as laid out, else go anywhere in it. A metadata op has the
+ * file for its offset.
+ */
+void fs_pick(struct thread_info *thread, struct io_u *io)
+{
+	unsigned i = rnd_range(io_rand(thread, io->num, RND_FILE), 0,
+			       thread->files - 1);
+	unsigned long long a = thread->align, size;
+	struct fs_file *f;
+	int j = i;
+
+	switch (io->rw) {
+	case READ:
+	case DISCARD:
+	case ZERO:
+		j = fs_find(thread, i, 1, 1);
+		if (j == -1) {
+			io->rw = WRITE;
+			j = i;
+		}
+		break;
+	case CREATE:
+		j = fs_find(thread, i, 0, 0);
+		break;
+	case UNLINK:
+	case RENAME:
+		j = fs_find(thread, i, 1, 0);
+		break;
+	default:
+		break;
+	}
+	io->file = j == -1 ? i : (unsigned) j;
+	f = &thread->fs[io->file];
+
+	if (io->rw >= OPEN) {
+		io->start = io->file;
+		io->count = 0;
+		return;
+	}
+
+	size = io->rw == WRITE || io->rw == DC ? f->target : f->size;
+	if (io->count > size)
+		io->count = size / a * a;
+	if ((io->rw == WRITE || io->rw == DC) && f->size < f->target) {
+		io->start = f->size / a * a;
+		if (io->count > f->target - io->start)
+			io->count = f->target - io->start;
+	} else {
+		io->start = rnd_range(io_rand(thread, io->num, RND_OFFSET), 0,
+				      (size - io->count) / a) * a;
+	}
+	if ((io->rw == WRITE || io->rw == DC) &&
+	    io->start + io->count > f->size)
+		f->size = io->start + io->count;
+}
+
+/* Do the metadata op io, a file which isn't there being as expected
+ * of it.
+ */
+int fs_meta(struct thread_info *thread, struct io_u *io)
+{
+	struct fs_file *f = &thread->fs[io->file];
+	char path[64], to[64];
+	struct stat st;
+	int fd, res = 0;
+
+	fs_path(thread, io->file, f->renamed, path, sizeof(path));
+	switch (io->rw) {
+	case STAT:
+		res = fstatat(thread->fs_dir, path, &st, 0);
+		break;
+	case CREATE:
+		fd = openat(thread->fs_dir, path, O_WRONLY | O_CREAT | O_TRUNC,
+			    0644);
+		res = fd == -1 ? -1 : close(fd);
+		if (res == 0) {
+			f->exists = 1;
+			f->size = 0;
+		}
+		break;
+	case UNLINK:
+		fs_evict(thread, io->file);
+		res = unlinkat(thread->fs_dir, path, 0);
+		if (res == 0) {
+			f->exists = 0;
+			f->size = 0;
+		}
+		break;
+	case RENAME:
+		fs_path(thread, io->file, !f->renamed, to, sizeof(to));
+		res = renameat(thread->fs_dir, path, thread->fs_dir, to);
+		if (res == 0)
+			f->renamed = !f->renamed;
+		break;
+	default:
+		break;
+	}
+
+	if (res == -1 && errno == ENOENT && !f->exists)
+		res = 0;
+
+	return res;
+}
+
+/* Lay out file i to its size, unless it's already that big, at its
+ * first name.
+ */
+int fs_layout(struct thread_info *thread, unsigned i, char *buf,
+	      unsigned long long *laid)
+{
+	struct fs_file *f = &thread->fs[i];
+	unsigned long long done;
+	char path[64], to[64];
+	struct stat st;
+	ssize_t res;
+	int fd;
+
+	fs_path(thread, i, 1, path, sizeof(path));
+	fs_path(thread, i, 0, to, sizeof(to));
+	if (fstatat(thread->fs_dir, path, &st, 0) == 0 &&
+	    renameat(thread->fs_dir, path, thread->fs_dir, to) == -1)
+		goto Err;
+
+	fd = openat(thread->fs_dir, to, O_WRONLY | O_CREAT, 0644);
+	if (fd == -1 || fstat(fd, &st) == -1)
+		goto Err;
+	if ((unsigned long long) st.st_size > f->target &&
+	    ftruncate(fd, f->target) == -1)
+		goto Err_close;
+	for (done = st.st_size; done < f->target; done += res) {
+		res = f->target - done < FS_LAYOUT_BUF ?
+			f->target - done : FS_LAYOUT_BUF;
+		res = pwrite(fd, buf, res, done);
+		if (res <= 0)
+			goto Err_close;
+		*laid += res;
+	}
+	close(fd);
+
+	f->size = f->target;
+	f->exists = 1;
+
+	return 0;
+ Err_close:
+	close(fd);
+ Err:
+	fprintf(thread->fp, "Couldn't lay out %s: %s\n", to, strerror(errno));
+	return -1;
+}
+
+/* Make this thread's tree, iogen.<index> in the device's directory,
+ * of files sized per --file-size, and lay them out.
+ */
+int fs_setup(struct thread_info *thread)
+{
+	unsigned long long a = thread->align, laid = 0;
+	uint64_t start = now_ns();
+	char path[64], *buf;
+	struct fs_file *f;
+	unsigned i;
+
+	snprintf(path, sizeof(path), "iogen.%d", thread->index);
+	if (mkdirat(thread->fd, path, 0755) == -1 && errno != EEXIST) {
+		fprintf(thread->fp, "Couldn't create %s/%s: %s\n",
+			thread->device, path, strerror(errno));
+		return -1;
+	}
+	thread->fs_dir = openat(thread->fd, path, O_RDONLY | O_DIRECTORY);
+	if (thread->fs_dir == -1) {
+		fprintf(thread->fp, "Couldn't open %s/%s: %s\n",
+			thread->device, path, strerror(errno));
+		return -1;
+	}
+	close(thread->fd);
+	thread->fd = thread->fs_dir;
+
+	thread->fs_dirs = (thread->files + FS_DIR_FILES - 1) / FS_DIR_FILES;
+	for (i = 0; i < thread->fs_dirs; i++) {
+		snprintf(path, sizeof(path), "d%u", i);
+		if (mkdirat(thread->fs_dir, path, 0755) == -1 &&
+		    errno != EEXIST) {
+			fprintf(thread->fp, "Couldn't create %s: %s\n",
+				path, strerror(errno));
+			return -1;
+		}
+	}
+
+	thread->fs = calloc(thread->files, sizeof(*thread->fs));
+	buf = malloc(FS_LAYOUT_BUF);
+	if (!thread->fs || !buf) {
+		fprintf(thread->fp, "Out of memory for %u files\n",
+			thread->files);
+		free(buf);
+		return -1;
+	}
+	pattern_fill(buf, FS_LAYOUT_BUF, thread->seed);
+	thread->fs_head = thread->fs_tail = -1;
+	thread->fs_cached = 0;
+
+	for (i = 0; i < thread->files; i++) {
+		f = &thread->fs[i];
+		f->fd = -1;
+		f->target = thread->file_size[rnd_range(io_rand(thread, i,
+					RND_FILE_SIZE), 0, BS_SLOTS - 1)];
+		f->target = (f->target + a - 1) / a * a;
+		if (fs_layout(thread, i, buf, &laid)) {
+			free(buf);
+			return -1;
+		}
+	}
+	free(buf);
+
+	fprintf(thread->fp, "Tree: %u files in %u directories, laid out "
+		"%llu bytes in %.3f s\n", thread->files, thread->fs_dirs, laid,
+		(now_ns() - start) / 1e9);
+
+	return 0;
+}
+
+void fs_free(struct thread_info *thread)
+{
+	unsigned i;
+
+	for (i = 0; thread->fs && i < thread->files; i++)
+		fs_evict(thread, i);
+	free(thread->fs);
+	thread->fs = NULL;
+	close(thread->fs_dir);
+}
+
+/* ---------- Thread ---------- */
+
+/* Pick the op, size and offset of the next IO.
+ */
+static inline op_t io_op(struct thread_info *thread, uint64_t num)
+{
+	unsigned r, trim = thread->discard_pct + thread->zero_pct;
+	unsigned other = trim + thread->meta_pct;
+
+	if (thread->op != RW && other == 0)
+		return thread->op;
+	r = rnd_range(io_rand(thread, num, RND_OP), 0, 99);
+	if (r < thread->discard_pct)
+		return DISCARD;
+	else if (r < trim)
+		return ZERO;
+	else if (r < other)
+		return meta_op(thread, r - trim);
+	else if (thread->op != RW)
+		return thread->op;
+	/* the rest, scaled back to 0-99 */
+	return (r - other) * 100 / (100 - other) >= thread->rwmix_read ?
+		WRITE : READ;
+}
+
+static inline size_t io_count(struct thread_info *thread, uint64_t num,
+			      op_t rw)
+{
+	if (thread->bssplit)
+		return thread->bssplit[rw == READ ? BS_READ : BS_WRITE]
+			[rnd_range(io_rand(thread, num, RND_SIZE), 0,
+				   BS_SLOTS - 1)];
+	else if (thread->fixed)
+		return thread->fixed;
+	else
+		return rnd_range(io_rand(thread, num, RND_SIZE),
+				 thread->min_blk, thread->max_blk) *
+			thread->align;
+}
+
+/* Count a write towards the next flush, which is due once enough
+ * of them were generated.
+ */
+static inline void sync_count(struct thread_info *thread, op_t rw,
+			      size_t count)
+{
+	if (rw != WRITE && rw != DC && rw != COPY)
+		return;
+	thread->sync_writes++;
+	thread->sync_written += count;
+	if ((thread->sync_every && thread->sync_writes >= thread->sync_every) ||
+	    (thread->sync_bytes && thread->sync_written >= thread->sync_bytes)) {
+		thread->sync_due = thread->sync_written;
+		thread->sync_writes = 0;
+		thread->sync_written = 0;
+	}
+}
+
+int prep_io(struct thread_info *thread, struct io_u *io)
+{
+	io->num = thread->io_num++;
+	io->zone = NULL;
+
+	if (thread->trace) {
+		trace_io(thread, io);
+		sync_count(thread, io->rw, io->count);
+		return 0;
+	}
+
+	io->rw = io_op(thread, io->num);
+	io->count = io_count(thread, io->num, io->rw);
+
+	if (thread->files) {
+		fs_pick(thread, io);
+	} else if (thread->zoned && (io->rw == WRITE || io->rw == DC)) {
+		if (zone_write(thread, io))
+			return -1;
+	} else if (thread->seq)
+		io->start = seq_next(thread, io->count);
+	else if (thread->dist)
+		io->start = dist_blk(thread, io->num, thread->min_span_blk,
+				     (thread->max_span-io->count-1) /
+				     thread->align) * thread->align;
+	else
+		io->start = rnd_range(io_rand(thread, io->num, RND_OFFSET),
+				      thread->min_span_blk,
+				      (thread->max_span-io->count-1) /
+				      thread->align) * thread->align;
+	io->phase = 0;
+	sync_count(thread, io->rw, io->count);
+	rate_sched(thread, io);
+
+	return 0;
+}
+
+/* The flush of the writes counted by sync_count(). It takes no IO
+ * number, its count being the bytes written since the last one.
+ */
+void prep_flush(struct thread_info *thread, struct io_u *io)
+{
+	io->num = thread->io_num;
+	io->rw = FLUSH;
+	io->start = 0;
+	io->count = thread->sync_due;
+	io->sched_ns = 0;
+	io->start_ns = 0;
+	io->phase = 0;
+	io->zone = NULL;
+	thread->sync_due = 0;
+}
+
+/* Start at IO number first. Only sequential IO and flushes depend on
+ * the IOs before it, where they ended and how much they wrote.
+ */
+void seek_io(struct thread_info *thread, uint64_t first)
+{
+	uint64_t num;
+	size_t count;
+	op_t rw;
+
+	thread->io_num = first;
+	if (!thread->seq && !thread->sync_every && !thread->sync_bytes)
+		return;
+
+	if (thread->seq)
+		seq_reset(thread);
+	for (num = 0; num < first; num++) {
+		rw = io_op(thread, num);
+		count = io_count(thread, num, rw);
+		if (thread->seq)
+			seq_next(thread, count);
+		sync_count(thread, rw, count);
+	}
+	thread->sync_due = 0;
+}
+
+/* Discard or write zeroes, synchronously.
+ */
+int trim_io(struct thread_info *thread, struct io_u *io)
+{
+	uint64_t range[2] = { io->start, io->count };
+
+	if (thread->is_blk)
+		return ioctl(thread->fd, io->rw == DISCARD ? BLKDISCARD :
+			     BLKZEROOUT, range);
+	else
+		return fallocate(thread->fd, io->rw == DISCARD ?
+				 FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE :
+				 FALLOC_FL_ZERO_RANGE, io->start, io->count);
+}
+
+/* Fill the write buffer of a DC op with random data.
+ */
+void fill_io(struct thread_info *thread, struct io_u *io)
+{
+	pattern_fill(io->buf, io->count, io_rand(thread, io->num, RND_DATA));
+}
+
+/* Point the write buffer of a duplicate at the start of the payload.
+ * Other writes copy it from an aligned random offset into their own
+ * buffer, then stamp each chunk with the thread, IO number and chunk,
+ * which keeps them unique at a cost of 24 bytes of compressibility a
+ * chunk.
+ */
+void payload_io(struct thread_info *thread, struct io_u *io)
+{
+	uint64_t r = io_rand(thread, io->num, RND_PAYLOAD);
+	uint64_t *stamp;
+	size_t off;
+
+	if (io->rw != WRITE && io->rw != DC)
+		return;
+	if ((uint32_t) r % 100 < thread->dedupe_pct) {
+		io->buf = thread->payload_buf;
+		return;
+	}
+
+	off = (r >> 32) % (PAYLOAD_SIZE / thread->align) * thread->align;
+	io->buf = io->own_buf;
+	memcpy(io->buf, thread->payload_buf + off, io->count);
+	for (off = 0; off + 3 * sizeof(*stamp) <= io->count;
+	     off += COMPRESS_CHUNK) {
+		stamp = (uint64_t *) ((char *) io->buf + off);
+		stamp[0] = (uint64_t) thread->seed << 32 | thread->index;
+		stamp[1] = io->num;
+		stamp[2] = off / COMPRESS_CHUNK;
+	}
+}
+
+/* Compare what a DC op wrote to what it read back.
+ */
+int verify_io(struct thread_info *thread, struct io_u *io)
+{
+	uint8_t *a = io->buf, *b = io->buf2;
+	size_t i;
+
+	i = pattern_cmp(a, b, io->count);
+	if (i < io->count) {
+		fprintf(thread->fp,
+			"op: %-5s io: %10lu offs: %16lu "
+			"wrote %02Xh read %02Xh\n",
+			op2str[io->rw], io->num, io->start+i,
+			a[i], b[i]);
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifndef RWF_HIPRI
+#define RWF_HIPRI	0x00000001
+#endif
+#ifndef RWF_DSYNC
+#define RWF_DSYNC	0x00000002
+#endif
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT	0x00000008
+#endif
+
+/* write(2) at the file offset, durable on return.
+ */
+static inline ssize_t write_dsync(int fd, void *buf, size_t count)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
+
+	return pwritev2(fd, &iov, 1, -1, RWF_DSYNC);
+}
+
+/* Read io->count bytes into io->buf2, or write them from io->buf, as
+ * rw is READ or WRITE. The sync engine does it at the file offset, in
+ * one go. The others do it at io->start, through as many short
+ * transfers as it takes, and an IO which would block under RWF_NOWAIT
+ * is counted, then done blocking. Where RWF_NOWAIT isn't supported,
+ * e.g. buffered writes on some filesystems, that op is done blocking
+ * from then on.
+ */
+ssize_t sync_rw(struct thread_info *thread, struct io_u *io, op_t rw)
+{
+	char *buf = rw == WRITE ? io->buf : io->buf2;
+	int flags = thread->rw_flags;
+	size_t done = 0;
+	ssize_t res;
+
+	if (thread->engine == ENGINE_SYNC && rw == READ)
+		return read(thread->fd, buf, io->count);
+	else if (thread->engine == ENGINE_SYNC)
+		return thread->fua ? write_dsync(thread->fd, buf, io->count) :
+			write(thread->fd, buf, io->count);
+
+	if (rw == WRITE && thread->fua)
+		flags |= RWF_DSYNC;
+	if (thread->no_nowait & 1 << rw)
+		flags &= ~RWF_NOWAIT;
+	while (done < io->count) {
+		struct iovec iov = {
+			.iov_base = buf + done,
+			.iov_len = io->count - done,
+		};
+		off64_t offs = io->start + done;
+
+		if (thread->engine == ENGINE_PSYNC && !flags && rw == WRITE)
+			res = pwrite(thread->fd, iov.iov_base, iov.iov_len,
+				     offs);
+		else if (thread->engine == ENGINE_PSYNC && !flags)
+			res = pread(thread->fd, iov.iov_base, iov.iov_len,
+				    offs);
+		else if (rw == WRITE)
+			res = pwritev2(thread->fd, &iov, 1, offs, flags);
+		else
+			res = preadv2(thread->fd, &iov, 1, offs, flags);
+
+		if (res == -1 && errno == EAGAIN && (flags & RWF_NOWAIT)) {
+			STAT_ADD(thread->stats->would_block, 1);
+			flags &= ~RWF_NOWAIT;
+			continue;
+		}
+		if (res == -1 && errno == EOPNOTSUPP && (flags & RWF_NOWAIT)) {
+			fprintf(thread->fp, "RWF_NOWAIT isn't supported for "
+				"op: %s, done blocking from now on\n",
+				op2str[rw]);
+			thread->no_nowait |= 1 << rw;
+			flags &= ~RWF_NOWAIT;
+			continue;
+		}
+		if (res == -1)
+			return -1;
+		if (res == 0)
+			break;	/* the end of the device */
+		done += res;
+	}
+
+	return done;
+}
+
+/* The pipe splice() copies through, as big as the biggest IO if we
+ * may, else the copy takes more than one trip through it.
+ */
+int copy_pipe_open(struct thread_info *thread)
+{
+	if (pipe2(thread->copy_pipe, O_CLOEXEC) == -1) {
+		fprintf(thread->fp, "Couldn't create the copy pipe: %s\n",
+			strerror(errno));
+		thread->copy_pipe[0] = thread->copy_pipe[1] = -1;
+		return -1;
+	}
+	fcntl(thread->copy_pipe[1], F_SETPIPE_SZ, (int) thread->max_io);
+
+	return 0;
+}
+
+void copy_pipe_close(struct thread_info *thread)
+{
+	if (thread->copy_pipe[0] != -1) {
+		close(thread->copy_pipe[0]);
+		close(thread->copy_pipe[1]);
+		thread->copy_pipe[0] = thread->copy_pipe[1] = -1;
+	}
+}
+
+/* Open the device copied to. A block device bounds the span, as
+ * we copy to the offset we read from, a file grows.
+ */
+int copy_open(struct thread_info *thread)
+{
+	int flags = O_WRONLY;
+	struct stat st;
+	off64_t end;
+
+	if (thread->o_direct)
+		flags |= O_DIRECT;
+	if (thread->o_sync)
+		flags |= O_SYNC;
+	else if (thread->fua)
+		flags |= O_DSYNC;
+	thread->copy_fd = open(thread->copy_to, flags);
+	if (thread->copy_fd == -1) {
+		fprintf(thread->fp, "Couldn't open device %s : %s\n",
+			thread->copy_to, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(thread->copy_fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+		end = lseek64(thread->copy_fd, 0, SEEK_END);
+		if (end == -1) {
+			fprintf(thread->fp, "Couldn't determine the size of "
+				"device %s: %s\n", thread->copy_to,
+				strerror(errno));
+			return -1;
+		}
+		if ((unsigned long long) end < thread->max_span) {
+			fprintf(thread->fp, "Max span %llu bounded by %s to "
+				"%lld\n", thread->max_span, thread->copy_to,
+				(long long) end);
+			thread->max_span = end;
+		}
+	}
+
+	if (thread->copy_method == COPY_SPLICE)
+		return copy_pipe_open(thread);
+
+	return 0;
+}
+
+void copy_close(struct thread_info *thread)
+{
+	if (thread->copy_fd != -1) {
+		close(thread->copy_fd);
+		thread->copy_fd = -1;
+	}
+	copy_pipe_close(thread);
+}
+
+/* Up to count bytes at offs, from the device into the pipe and from
+ * it to copy_to. All of what went into the pipe comes out of it, or
+ * the pipe is started afresh, so that no stale data lingers in it.
+ */
+ssize_t copy_splice(struct thread_info *thread, off64_t offs, size_t count)
+{
+	loff_t in = offs, out = offs;
+	ssize_t res, len, done = 0;
+	int err;
+
+	len = splice(thread->fd, &in, thread->copy_pipe[1], NULL, count,
+		     SPLICE_F_MOVE);
+	if (len <= 0)
+		return len;
+
+	while (done < len) {
+		res = splice(thread->copy_pipe[0], NULL, thread->copy_fd, &out,
+			     len - done, SPLICE_F_MOVE);
+		if (res <= 0) {
+			err = res ? errno : EIO;
+			copy_pipe_close(thread);
+			copy_pipe_open(thread);
+			errno = err;
+			return -1;
+		}
+		done += res;
+	}
+
+	return len;
+}
+
+/* Up to count bytes at offs, read into buf and written out of it.
+ */
+ssize_t copy_rw(struct thread_info *thread, void *buf, off64_t offs,
+		size_t count)
+{
+	ssize_t res, len, done = 0;
+
+	len = pread(thread->fd, buf, count, offs);
+	if (len <= 0)
+		return len;
+
+	while (done < len) {
+		res = pwrite(thread->copy_fd, buf + done, len - done,
+			     offs + done);
+		if (res <= 0) {
+			if (res == 0)
+				errno = EIO;
+			return -1;
+		}
+		done += res;
+	}
+
+	return len;
+}
+
+/* Copy io->count bytes at io->start from the device to the same
+ * offset of copy_to, through as many short copies as it takes. The
+ * kernel won't copy_file_range() between block devices or some file
+ * systems, for which we fall back to splice() for good.
+ */
+ssize_t copy_io(struct thread_info *thread, struct io_u *io)
+{
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < io->count) {
+		loff_t in = io->start + done, out = in;
+		size_t count = io->count - done;
+
+		switch (thread->copy_method) {
+		case COPY_RANGE:
+			res = copy_file_range(thread->fd, &in, thread->copy_fd,
+					      &out, count, 0);
+			if (res == -1 && done == 0 &&
+			    (errno == EXDEV || errno == EINVAL ||
+			     errno == EOPNOTSUPP || errno == ENOSYS)) {
+				fprintf(thread->fp, "copy_file_range: %s, "
+					"falling back to splice\n",
+					strerror(errno));
+				thread->copy_method = COPY_SPLICE;
+				if (copy_pipe_open(thread))
+					return -1;
+				continue;
+			}
+			break;
+		case COPY_SPLICE:
+			res = copy_splice(thread, in, count);
+			break;
+		default:
+			res = copy_rw(thread, io->buf + done, in, count);
+			break;
+		}
+
+		if (res == -1)
+			return -1;
+		if (res == 0)
+			break;	/* the end of either */
+		done += res;
+	}
+
+	return done;
+}
+
+/* Flush what was written since the last flush, see sync_count().
+ */
+int sync_flush(struct thread_info *thread)
+{
+	struct io_u _io, *io = &_io;
+	uint64_t now = 0;
+	int res = 0;
+
+	prep_flush(thread, io);
+	if (!thread->dry_run) {
+		int fd = thread->op == COPY ? thread->copy_fd : thread->fd;
+
+		io->start_ns = now_ns();
+		res = thread->sync_data ? fdatasync(fd) : fsync(fd);
+		now = now_ns();
+		if (res == 0)
+			account_io(thread->stats, LAT_FLUSH, 0,
+				   now - io->start_ns);
+		thread->last_ns = now;
+	}
+
+	if (thread->io_log || res == -1)
+		log_io(thread, io, res, now);
+
+	return res;
+}
+
+int do_io_op(struct thread_info *thread)
+{
+	int res = 0;
+	uint64_t now = 0;
+	struct io_u _io, *io = &_io;
+
+	if (prep_io(thread, io))
+		return -1;
+
+	io->buf = thread->buf;
+	io->own_buf = io->buf;
+	if (io->rw == DC)
+		io->buf2 = thread->buf2;
+	else
+		io->buf2 = io->buf;
+
+	if (thread->payload)
+		payload_io(thread, io);
+	else if (io->rw == DC)
+		fill_io(thread, io);
+
+	if (!thread->dry_run) {
+		if (rate_wait(thread, io))
+			return 0;
+		if (thread->files && fs_open(thread, io))
+			return -1;
+		if (thread->engine == ENGINE_SYNC && io->rw < OPEN &&
+		    lseek64(thread->fd, io->start, SEEK_SET) == -1) {
+			fprintf(thread->fp, "lseek64 error (%s) for "
+				"op: %s io: %lu offs: %lu count: %lu\n",
+				strerror(errno), op2str[io->rw], io->num,
+				io->start, io->count);
+			return -1;
+		}
+
+		now = now_ns();
+		account_drift(thread, io, now);
+		io->start_ns = io->issue_ns = io->sched_ns ? io->sched_ns :
+			now;
+		switch (io->rw) {
+		case DC:
+		case WRITE:
+			res = sync_rw(thread, io, WRITE);
+			if (io->zone)
+				zone_done(thread, io, res);
+			if (res > 0) {
+				now = now_ns();
+				account_io(thread->stats, LAT_WRITE, res,
+					   now - io->issue_ns);
+				io->issue_ns = now;
+			}
+			if (io->rw != DC)
+				break;
+			else if (thread->engine == ENGINE_SYNC &&
+				 lseek64(thread->fd, io->start, SEEK_SET) == -1) {
+				fprintf(thread->fp, "lseek64 error (%s) for "
+					"op: %s io: %lu offs: %lu count: %lu\n",
+					strerror(errno), op2str[io->rw],
+					io->num, io->start, io->count);
+				return -1;
+			}
+		case READ:
+			res = sync_rw(thread, io, READ);
+			if (res > 0) {
+				now = now_ns();
+				account_io(thread->stats, LAT_READ, res,
+					   now - io->issue_ns);
+			}
+			break;
+		case COPY:
+			res = copy_io(thread, io);
+			if (res > 0) {
+				now = now_ns();
+				account_io(thread->stats, LAT_COPY, res,
+					   now - io->issue_ns);
+			}
+			break;
+		case DISCARD:
+		case ZERO:
+			res = trim_io(thread, io);
+			if (res == 0) {
+				now = now_ns();
+				account_io(thread->stats, op2lat[io->rw], 0,
+					   now - io->issue_ns);
+				res = io->count;
+			}
+			break;
+		case STAT:
+		case CREATE:
+		case UNLINK:
+		case RENAME:
+			res = fs_meta(thread, io);
+			if (res == 0) {
+				now = now_ns();
+				account_io(thread->stats, op2lat[io->rw], 0,
+					   now - io->issue_ns);
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (io->rw == DC) {
+			if (verify_io(thread, io)) {
+				res = -1;
+			} else {
+				now = now_ns();
+				account_io(thread->stats, LAT_VERIFY, 0,
+					   now - io->start_ns);
+			}
+		}
+		thread->last_ns = now;
+	}
+
+	if (thread->io_log || res == -1)
+		log_io(thread, io, res, now);
+	if (res != -1 && thread->sync_due && sync_flush(thread))
+		return -1;
+
+	return res;
+}
+
+void print_stats(FILE *fp, struct thread_stats *st)
+{
+	int i;
+
+	fprintf(fp, "Bytes read:    %16lu\n", st->bytes_read);
+	fprintf(fp, "Bytes written: %16lu\n", st->bytes_written);
+	fprintf(fp, "Total:         %16lu\n", st->bytes_read +
+		st->bytes_written);
+	fprintf(fp, "Read IOPs:     %8lu\n", st->read_iops);
+	fprintf(fp, "Write IOPs:    %8lu\n", st->write_iops);
+	fprintf(fp, "Total:         %8lu\n", st->read_iops +
+		st->write_iops);
+	if (st->lat[LAT_COPY].count) {
+		fprintf(fp, "Bytes copied:  %16lu\n", st->bytes_copied);
+		fprintf(fp, "Copies:        %8lu\n", st->lat[LAT_COPY].count);
+	}
+	if (st->would_block)
+		fprintf(fp, "Would block:   %8lu\n", st->would_block);
+	if (st->user_us || st->sys_us) {
+		fprintf(fp, "CPU user:      %12.3f s\n", st->user_us / 1e6);
+		fprintf(fp, "CPU sys:       %12.3f s\n", st->sys_us / 1e6);
+		if (data_ios(st))
+			fprintf(fp, "CPU per IO:    %12.2f usec\n",
+				(double) (st->user_us + st->sys_us) /
+				data_ios(st));
+	}
+	for (i = 0; i < LAT_NUM; i++)
+		print_lat(fp, lat2str[i], &st->lat[i]);
+	if (st->lat[LAT_OPEN].count) {
+		struct lat_hist h;
+
+		memset(&h, 0, sizeof(h));
+		for (i = LAT_OPEN; i <= LAT_RENAME; i++)
+			lat_merge(&h, &st->lat[i]);
+		print_lat(fp, "All metadata", &h);
+	}
+	print_lat(fp, "Replay drift", &st->drift);
+	if (st->outages)
+		fprintf(fp, "Outages:       %8lu\n", st->outages);
+	print_lat(fp, "Loss detect", &st->detect);
+	print_lat(fp, "Outage", &st->outage);
+	print_lat(fp, "Recovery", &st->recover);
+}
+
+struct thread_info *this;
+
+void sighandler_thread(int sig)
+{
+	fprintf(this->fp, "Thread %d terminated by signal %d\n",
+		getpid(), sig);
+	print_stats(this->fp, this->stats);
+	print_time(this->fp);
+	signal(sig, SIG_DFL);
+	kill(getpid(), sig);
+}
+
+/* Terminate this IO thread, be it a process or a pthread.
+ */
+void thread_exit(struct thread_info *thread, int status)
+{
+	uint64_t cpu[2];
+
+	io_log_stop(thread);
+	thread_cpu(thread, cpu);
+	STAT_SET(thread->stats->user_us, cpu[0] - thread->cpu_base[0]);
+	STAT_SET(thread->stats->sys_us, cpu[1] - thread->cpu_base[1]);
+	STAT_SET(thread->stats->end_ns, now_ns());
+	if (!thread->pthreads)
+		exit(status);
+
+	if (write(thread->done_fd, &thread->index, sizeof(thread->index)) !=
+	    sizeof(thread->index))
+		fprintf(stderr, "Thread %d couldn't notify: %s\n",
+			thread->tid, strerror(errno));
+	pthread_exit((void *) (long) status);
+}
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+
+/* Pin the calling thread to its CPU, if it has one, and find out
+ * which NUMA node it's on.
+ */
+void pin_thread(struct thread_info *thread)
+{
+	unsigned cpu, node;
+	cpu_set_t set;
+
+	if (thread->cpu != -1) {
+		CPU_ZERO(&set);
+		CPU_SET(thread->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			fprintf(thread->fp, "Couldn't pin to CPU %d: %s\n",
+				thread->cpu, strerror(errno));
+	}
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		thread->node = node;
+	else
+		thread->node = -1;
+}
+
+/* Allocate an IO buffer on this thread's NUMA node. It's page
+ * aligned and touched here, so that it is faulted in on the node
+ * we're pinned to, before any IO is timed. With hugepages, size
+ * must be a multiple of HUGE_PAGE_SIZE.
+ */
+void *alloc_buf(struct thread_info *thread, size_t size)
+{
+	unsigned long mask;
+	void *buf = MAP_FAILED;
+
+	if (thread->hugepages) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (buf == MAP_FAILED)
+			fprintf(thread->fp, "Couldn't get %zu bytes of huge "
+				"pages, trying transparent ones: %s\n",
+				size, strerror(errno));
+	}
+	if (buf == MAP_FAILED) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			return NULL;
+		if (thread->hugepages)
+			madvise(buf, size, MADV_HUGEPAGE);
+	}
+
+	if (thread->cpu != -1 && thread->node >= 0 &&
+	    thread->node < 8*sizeof(mask)) {
+		mask = 1UL << thread->node;
+		if (syscall(SYS_mbind, buf, size, MPOL_PREFERRED, &mask,
+			    8*sizeof(mask) + 1, 0) == -1)
+			fprintf(thread->fp, "Couldn't bind buffer to node "
+				"%d: %s\n", thread->node, strerror(errno));
+	}
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+void free_buf(void *buf, size_t size)
+{
+	if (buf)
+		munmap(buf, size);
+}
+
+/* Generate the data which writes are taken from: PAYLOAD_SIZE bytes,
+ * plus the largest IO from the last offset.
+ */
+int setup_payload(struct thread_info *thread)
+{
+	size_t c, n = COMPRESS_CHUNK * (100 - thread->compress_pct) / 100;
+	char *p;
+
+	thread->payload_size = PAYLOAD_SIZE + thread->buf_size;
+	thread->payload_buf = alloc_buf(thread, thread->payload_size);
+	if (!thread->payload_buf) {
+		fprintf(thread->fp, "Couldn't allocate %zu bytes of "
+			"payload\n", thread->payload_size);
+		return -1;
+	}
+
+	/* PAGE_SIZE multiples, and the fill rounds up to no more
+	 * than a chunk */
+	for (c = 0; c < thread->payload_size / COMPRESS_CHUNK; c++) {
+		p = thread->payload_buf + c * COMPRESS_CHUNK;
+		if (n)
+			pattern_fill(p, n, io_rand(thread, c, RND_POOL));
+		memset(p + n, 0, COMPRESS_CHUNK - n);
+	}
+
+	return 0;
+}
+
+/* Allocate all IO buffers this thread will ever need, num_bufs of
+ * them, each of buf_size, a multiple of the page size and of align,
+ * so that the hot path never allocates and O_DIRECT works at any
+ * IO size.
+ */
+int setup_pool(struct thread_info *thread, int num_bufs)
+{
+	size_t a = thread->align > PAGE_SIZE ? thread->align : PAGE_SIZE;
+
+	thread->buf_size = (thread->max_io + a - 1) / a * a;
+	thread->pool_size = num_bufs * thread->buf_size;
+	if (thread->hugepages)
+		thread->pool_size = (thread->pool_size + HUGE_PAGE_SIZE - 1) /
+			HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+	thread->pool = alloc_buf(thread, thread->pool_size);
+	if (!thread->pool) {
+		fprintf(thread->fp, "Couldn't allocate %d buffers of size "
+			"%zu\n", num_bufs, thread->buf_size);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void *get_buf(struct thread_info *thread, int index)
+{
+	return thread->pool + index * thread->buf_size;
+}
+
+/* The alignment O_DIRECT needs: the logical block size of a block
+ * device, else the preferred IO size of the file's filesystem.
+ */
+unsigned long long dev_align(struct thread_info *thread)
+{
+	struct stat st;
+	int bs;
+
+	if (thread->dry_run || fstat(thread->fd, &st) == -1)
+		return 512;
+	if (S_ISBLK(st.st_mode) && ioctl(thread->fd, BLKSSZGET, &bs) == 0)
+		return bs;
+
+	return st.st_blksize;
+}
+
+/* Express the IO sizes and the span in units of align.
+ */
+int setup_align(struct thread_info *thread)
+{
+	unsigned long long a;
+	int i;
+
+	if (thread->align == 0)
+		thread->align = thread->o_direct ? dev_align(thread) : 1;
+	a = thread->align;
+
+	if (thread->fixed % a) {
+		fprintf(thread->fp, "Fixed IO size %llu isn't a multiple "
+			"of the alignment %llu\n", thread->fixed, a);
+		return -1;
+	}
+
+	thread->min_blk = (thread->min_io + a - 1) / a;
+	thread->max_blk = thread->max_io / a;
+	thread->min_span_blk = (thread->min_span + a - 1) / a;
+	for (i = 0; thread->bssplit && i < 2 * BS_SLOTS; i++) {
+		if (thread->bssplit[i / BS_SLOTS][i % BS_SLOTS] % a) {
+			fprintf(thread->fp, "IO size %llu isn't a multiple "
+				"of the alignment %llu\n",
+				thread->bssplit[i / BS_SLOTS][i % BS_SLOTS], a);
+			return -1;
+		}
+	}
+
+	if (!thread->fixed && !thread->trace && !thread->bssplit &&
+	    (thread->max_blk == 0 || thread->min_blk > thread->max_blk)) {
+		fprintf(thread->fp, "No IO size between %llu and %llu is a "
+			"multiple of the alignment %llu\n", thread->min_io,
+			thread->max_io, a);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* How often to retry opening a lost device, and IO to it once
+ * reopened, between inotify events on its directory.
+ */
+#define DEVICE_POLL_MS	100
+
+/* Wait for an event in the device's directory, or DEVICE_POLL_MS,
+ * whichever comes first.
+ */
+void device_poll(int ifd)
+{
+	char ev[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+
+	if (poll(&pfd, ifd == -1 ? 0 : 1, DEVICE_POLL_MS) > 0)
+		while (read(ifd, ev, sizeof(ev)) > 0)
+			;
+}
+
+/* IO to the device failed, the IO having taken detect_ns to fail.
+ * Reopen it as soon as it reappears, which is when udev creates its
+ * node or link. Return -1 if the thread has to stop before then.
+ */
+int wait_for_device(struct thread_info *thread, uint64_t detect_ns)
+{
+	char dir[PATH_MAX];
+	int ifd, res = 0;
+	uint64_t now;
+
+	if (thread->outage_ns == 0) {
+		thread->outage_ns = now_ns();
+		STAT_ADD(thread->stats->outages, 1);
+		lat_add(&thread->stats->detect, detect_ns);
+		fprintf(thread->fp, "Device %s disappeared on ",
+			thread->device);
+		print_time(thread->fp);
+		fprintf(thread->fp, "Waiting for device %s to come back "
+			"on...\n", thread->device);
+	}
+
+	snprintf(dir, sizeof(dir), "%s", thread->device);
+	ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd != -1 &&
+	    inotify_add_watch(ifd, dirname(dir), IN_CREATE | IN_ATTRIB |
+			      IN_MOVED_TO) == -1) {
+		close(ifd);
+		ifd = -1;
+	}
+
+	/* Reopened, yet IO still fails: don't spin */
+	if (thread->reopen_ns > thread->outage_ns)
+		device_poll(ifd);
+
+	close(thread->fd);
+	while ((thread->fd = open(thread->device, thread->open_flags)) == -1) {
+		now = now_ns();
+		if (thread->stop_ns && now >= thread->stop_ns) {
+			thread->stopping = 1;
+			res = -1;
+			break;
+		}
+		device_poll(ifd);
+	}
+	if (ifd != -1)
+		close(ifd);
+	if (res)
+		return res;
+
+	if (thread->reopen_ns < thread->outage_ns) {
+		fprintf(thread->fp, "Device %s came back on ",
+			thread->device);
+		print_time(thread->fp);
+	}
+	thread->reopen_ns = now_ns();
+
+	return 0;
+}
+
+/* IO succeeded at now after the device was lost.
+ */
+void device_back(struct thread_info *thread, uint64_t now)
+{
+	lat_add(&thread->stats->outage, thread->reopen_ns - thread->outage_ns);
+	lat_add(&thread->stats->recover, now > thread->reopen_ns ?
+		now - thread->reopen_ns : 0);
+	thread->outage_ns = 0;
+	fprintf(thread->fp, "Device %s: IO succeeded again on ",
+		thread->device);
+	print_time(thread->fp);
+}
+
+/* Issue one IO at a time until num_ios have been done.
+ */
+void do_sync(struct thread_info *thread)
+{
+	thread->buf = get_buf(thread, 0);
+	if (thread->op == DC)
+		thread->buf2 = get_buf(thread, 1);
+	thread->rate_start_ns = now_ns();
+	if (thread->num_ios == 0)
+		return;
+
+	do {
+		int res;
+
+		if (control_check(thread) || control_wait(thread))
+			break;
+		res = do_io_op(thread);
+		if (check_deadlines(thread, thread->dry_run ? now_ns() :
+				    thread->last_ns))
+			break;
+		if (res == -1 && thread->restart) {
+			if (wait_for_device(thread, now_ns() - thread->last_ns))
+				break;
+		} else if (res == -1) {
+			break;
+		} else if (thread->outage_ns && res > 0) {
+			device_back(thread, thread->last_ns);
+		}
+
+		if (thread->num_ios == -1)
+			;
+		else if (--thread->num_ios <= 0)
+			break;
+	} while (1);
+}
+
+/* ---------- io_uring engine ---------- */
+
+#define smp_load_acquire(_P)	 __atomic_load_n((_P), __ATOMIC_ACQUIRE)
+#define smp_store_release(_P, _V) __atomic_store_n((_P), (_V), __ATOMIC_RELEASE)
+
+struct uring {
+	int	fd;
+	unsigned flags;		  /* IORING_SETUP_* */
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_flags;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void	*sq_ring;
+	size_t	sq_ring_size;
+	void	*cq_ring;
+	size_t	cq_ring_size;
+	size_t	sqes_size;
+
+	int	fixed_files;
+	int	fixed_bufs;
+	int	bufs_per_io;	  /* 2 for DC, 1 otherwise */
+	int	payload_index;	  /* of the registered payload buffer */
+};
+
+int uring_setup(struct thread_info *thread, struct uring *ring)
+{
+	struct io_uring_params p;
+	void *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	if (thread->sqpoll) {
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = 1000;
+	}
+	if (thread->iopoll)
+		p.flags |= IORING_SETUP_IOPOLL;
+
+	/* One more for the rate limiting timeout */
+	ring->fd = syscall(__NR_io_uring_setup, thread->iodepth + 1, &p);
+	if (ring->fd == -1) {
+		fprintf(thread->fp, "io_uring_setup error: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	ring->flags = p.flags;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto Err;
+	ring->sq_ring = sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto Err;
+	}
+	ring->cq_ring = cq;
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto Err;
+
+	ring->sq_head  = sq + p.sq_off.head;
+	ring->sq_tail  = sq + p.sq_off.tail;
+	ring->sq_mask  = sq + p.sq_off.ring_mask;
+	ring->sq_flags = sq + p.sq_off.flags;
+	ring->sq_array = sq + p.sq_off.array;
+
+	ring->cq_head = cq + p.cq_off.head;
+	ring->cq_tail = cq + p.cq_off.tail;
+	ring->cq_mask = cq + p.cq_off.ring_mask;
+	ring->cqes    = cq + p.cq_off.cqes;
+
+	return 0;
+ Err:
+	fprintf(thread->fp, "io_uring mmap error: %s\n", strerror(errno));
+	return -1;
+}
+
+/* Register the device and the IO buffers with the ring, so that
+ * the kernel needn't look them up and map them on every IO.
+ * Failure isn't fatal, e.g. RLIMIT_MEMLOCK may be too small.
+ */
+void uring_register(struct thread_info *thread, struct uring *ring,
+		    struct io_u *ios)
+{
+	struct iovec *iov;
+	int i, n;
+
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+		    &thread->fd, 1) == 0)
+		ring->fixed_files = 1;
+	else
+		fprintf(thread->fp, "Couldn't register files: %s\n",
+			strerror(errno));
+
+	n = thread->iodepth * ring->bufs_per_io;
+	iov = malloc((n + 1) * sizeof(*iov));
+	if (!iov)
+		return;
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = get_buf(thread, i);
+		iov[i].iov_len = thread->buf_size;
+	}
+	if (thread->payload) {
+		ring->payload_index = n;
+		iov[n].iov_base = thread->payload_buf;
+		iov[n++].iov_len = thread->payload_size;
+	}
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+		    iov, n) == 0)
+		ring->fixed_bufs = 1;
+	else
+		fprintf(thread->fp, "Couldn't register buffers: %s\n",
+			strerror(errno));
+	free(iov);
+}
+
+/* The device came back on a new fd, point the registered file at it.
+ */
+int uring_update_file(struct thread_info *thread, struct uring *ring)
+{
+	struct io_uring_files_update up;
+
+	if (!ring->fixed_files)
+		return 0;
+
+	memset(&up, 0, sizeof(up));
+	up.fds = (unsigned long) &thread->fd;
+	if (syscall(__NR_io_uring_register, ring->fd,
+		    IORING_REGISTER_FILES_UPDATE, &up, 1) != 1) {
+		fprintf(thread->fp, "Couldn't update registered file: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+void uring_queue(struct thread_info *thread, struct uring *ring,
+		 struct io_u *io, uint64_t now)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	int write = io->rw == WRITE || (io->rw == DC && io->phase == 0);
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (ring->fixed_files) {
+		sqe->fd = 0;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = thread->fd;
+	}
+	switch (io->rw) {
+	case FLUSH:
+		/* after the writes in flight, which it has to cover */
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->flags |= IOSQE_IO_DRAIN;
+		if (thread->sync_data)
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	case DISCARD:
+	case ZERO:
+		/* fallocate(2), as laid out by the kernel */
+		sqe->opcode = IORING_OP_FALLOCATE;
+		sqe->off = io->start;
+		sqe->addr = io->count;
+		sqe->len = io->rw == DISCARD ?
+			FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE :
+			FALLOC_FL_ZERO_RANGE;
+		break;
+	default:
+		if (ring->fixed_bufs) {
+			sqe->opcode = write ? IORING_OP_WRITE_FIXED :
+				IORING_OP_READ_FIXED;
+			sqe->buf_index = io->index * ring->bufs_per_io +
+				(io->rw == DC && !write);
+			if (write && io->buf == thread->payload_buf)
+				sqe->buf_index = ring->payload_index;
+		} else {
+			sqe->opcode = write ? IORING_OP_WRITE :
+				IORING_OP_READ;
+		}
+		if (write && thread->fua)
+			sqe->rw_flags = RWF_DSYNC;
+		sqe->off = io->start;
+		sqe->addr = (unsigned long) (write ? io->buf : io->buf2);
+		sqe->len = io->count;
+		break;
+	}
+	sqe->user_data = io->index;
+	io->issue_ns = now;
+	if (io->phase == 0)
+		io->start_ns = now;
+
+	ring->sq_array[idx] = idx;
+	smp_store_release(ring->sq_tail, tail + 1);
+}
+
+#define TIMEOUT_TAG	(~0ULL)
+
+/* Have the kernel complete a fake IO at due, so that we can wait for
+ * that or a completion, whichever comes first.
+ */
+void uring_queue_timeout(struct uring *ring, struct __kernel_timespec *ts,
+			 uint64_t due, uint64_t now)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	ts->tv_sec = (due - now) / 1000000000ULL;
+	ts->tv_nsec = (due - now) % 1000000000ULL;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long) ts;
+	sqe->len = 1;
+	sqe->user_data = TIMEOUT_TAG;
+
+	ring->sq_array[idx] = idx;
+	smp_store_release(ring->sq_tail, tail + 1);
+}
+
+/* Submit what's been queued and wait for at least one completion.
+ */
+int uring_enter(struct uring *ring, unsigned to_submit)
+{
+	unsigned flags = IORING_ENTER_GETEVENTS;
+	int res;
+
+	if (ring->flags & IORING_SETUP_SQPOLL) {
+		/* Order the tail update before reading the flags.
+		 */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (*ring->sq_flags & IORING_SQ_NEED_WAKEUP)
+			flags |= IORING_ENTER_SQ_WAKEUP;
+	}
+
+	do {
+		res = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+			      flags, NULL, 0);
+	} while (res == -1 && errno == EINTR);
+
+	return res;
+}
+
+/* Account a completion. Return 1 if the IO was requeued (DC read
+ * back), 0 if it's done and -1 on error.
+ */
+int uring_complete(struct thread_info *thread, struct uring *ring,
+		   struct io_u *io, int res, uint64_t now)
+{
+	int write = io->rw == WRITE || (io->rw == DC && io->phase == 0);
+
+	if (write && io->zone)
+		zone_done(thread, io, res);
+	errno = res < 0 ? -res : 0;
+	if (res < 0) {
+		log_io(thread, io, res, now);
+		return -1;
+	}
+
+	if (io->rw == FLUSH || io->rw == DISCARD || io->rw == ZERO) {
+		account_io(thread->stats, op2lat[io->rw], 0,
+			   now - io->issue_ns);
+		if (thread->io_log)
+			log_io(thread, io, io->count, now);
+		return 0;
+	}
+
+	if (write) {
+		account_io(thread->stats, LAT_WRITE, res, now - io->issue_ns);
+		if (io->rw == DC) {
+			io->phase = 1;
+			uring_queue(thread, ring, io, now);
+			return 1;
+		}
+	} else {
+		account_io(thread->stats, LAT_READ, res, now - io->issue_ns);
+		if (io->rw == DC) {
+			if (verify_io(thread, io)) {
+				log_io(thread, io, -1, now);
+				return -1;
+			}
+			account_io(thread->stats, LAT_VERIFY, 0,
+				   now - io->start_ns);
+		}
+	}
+
+	if (thread->io_log)
+		log_io(thread, io, res, now);
+
+	return 0;
+}
+
+/* A DC op in flight must not overlap another one, else what
+ * the other wrote would fail our compare. An overlapping one is
+ * held back, prepared, at the top of the free list until the
+ * other completes.
+ */
+int uring_overlaps(struct thread_info *thread, struct io_u *ios,
+		   struct io_u *io)
+{
+	int i;
+
+	for (i = 0; i < thread->iodepth; i++) {
+		if (&ios[i] == io || ios[i].count == 0 ||
+		    ios[i].rw == FLUSH)
+			continue;
+		if (io->start < ios[i].start + ios[i].count &&
+		    ios[i].start < io->start + io->count)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* There's no io_uring op for BLKDISCARD, so that's done here and
+ * now. Return -1 on error.
+ */
+int uring_discard(struct thread_info *thread, struct io_u *io,
+		  uint64_t now)
+{
+	int res;
+
+	io->start_ns = io->issue_ns = now;
+	res = trim_io(thread, io);
+	now = now_ns();
+	if (res == -1) {
+		log_io(thread, io, res, now);
+		return -1;
+	}
+	account_io(thread->stats, LAT_DISCARD, 0, now - io->issue_ns);
+	if (thread->io_log)
+		log_io(thread, io, io->count, now);
+
+	return 0;
+}
+
+/* Keep up to iodepth IOs in flight until num_ios have been issued.
+ */
+int do_uring(struct thread_info *thread)
+{
+	struct uring ring;
+	struct io_u *ios, **free_ios;
+	struct __kernel_timespec ts;
+	unsigned nfree, inflight = 0, to_submit = 0;
+	long long left = thread->num_ios;
+	uint64_t detect_ns = 0;
+	int i, res = 0, err = 0, timeout = 0;
+
+	if (uring_setup(thread, &ring))
+		return -1;
+	ring.bufs_per_io = thread->op == DC ? 2 : 1;
+
+	ios = calloc(thread->iodepth, sizeof(*ios));
+	free_ios = malloc(thread->iodepth * sizeof(*free_ios));
+	if (!ios || !free_ios) {
+		fprintf(thread->fp, "Out of memory for %u IOs\n",
+			thread->iodepth);
+		return -1;
+	}
+	for (i = 0; i < thread->iodepth; i++) {
+		ios[i].index = i;
+		ios[i].buf = get_buf(thread, i * ring.bufs_per_io);
+		ios[i].own_buf = ios[i].buf;
+		if (thread->op != DC)
+			ios[i].buf2 = ios[i].buf;
+		else
+			ios[i].buf2 = get_buf(thread, i * 2 + 1);
+		free_ios[i] = &ios[i];
+	}
+	nfree = thread->iodepth;
+
+	uring_register(thread, &ring, ios);
+	thread->rate_start_ns = now_ns();
+
+	do {
+		unsigned head;
+		uint64_t now = now_ns(), due = 0;
+
+		check_deadlines(thread, now);
+		control_check(thread);
+
+		/* Keep the queue full, up to the IO which isn't due yet */
+		while (!err && !thread->stopping && !thread->paused &&
+		       nfree > 0 && inflight < thread->max_inflight) {
+			struct io_u *io = free_ios[nfree-1];
+
+			if (io->count == 0 && thread->sync_due) {
+				prep_flush(thread, io);
+			} else if (io->count == 0) {
+				if (left == 0)
+					break;
+				if (prep_io(thread, io)) {
+					err = 1;
+					break;
+				}
+				if (left > 0)
+					left--;
+			}
+			/* held back from before the rate was reset */
+			if (io->sched_ns && io->sched_ns < thread->rate_start_ns)
+				rate_sched(thread, io);
+			if (thread->stop_ns && io->sched_ns >= thread->stop_ns) {
+				thread->stopping = 1;
+				break;
+			}
+			if (io->sched_ns > now) {
+				now = now_ns();
+				if (io->sched_ns > now) {
+					due = io->sched_ns;
+					break;
+				}
+			}
+			if (io->rw == DC && uring_overlaps(thread, ios, io))
+				break;
+			if (io->rw == DISCARD && thread->is_blk) {
+				if (uring_discard(thread, io, io->sched_ns ?
+						  io->sched_ns : now_ns())) {
+					if (!err)
+						detect_ns = now_ns() -
+							io->issue_ns;
+					err = 1;
+				}
+				io->count = 0;
+				check_deadlines(thread, now_ns());
+				continue;
+			}
+			nfree--;
+			if (thread->payload)
+				payload_io(thread, io);
+			else if (io->rw == DC)
+				fill_io(thread, io);
+			account_drift(thread, io, now);
+			uring_queue(thread, &ring, io,
+				    io->sched_ns ? io->sched_ns : now_ns());
+			to_submit++;
+			inflight++;
+		}
+
+		if (due && inflight == 0) {
+			struct io_u io = { .sched_ns = due };
+
+			rate_wait(thread, &io);
+			continue;
+		} else if (due && !timeout) {
+			uring_queue_timeout(&ring, &ts, due, now);
+			to_submit++;
+			timeout = 1;
+		}
+
+		if (inflight == 0) {
+			if (thread->paused && !err && !thread->stopping) {
+				control_wait(thread);
+				continue;
+			}
+			if (err && thread->restart && !thread->stopping) {
+				if (wait_for_device(thread, detect_ns) ||
+				    uring_update_file(thread, &ring))
+					break;
+				err = 0;
+				continue;
+			}
+			break;
+		}
+
+		res = uring_enter(&ring, to_submit);
+		if (res == -1) {
+			fprintf(thread->fp, "io_uring_enter error: %s\n",
+				strerror(errno));
+			break;
+		}
+		to_submit -= (unsigned) res < to_submit ? res : to_submit;
+
+		now = now_ns();
+		head = *ring.cq_head;
+		while (head != smp_load_acquire(ring.cq_tail)) {
+			struct io_uring_cqe *cqe;
+			struct io_u *io;
+
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			if (cqe->user_data == TIMEOUT_TAG) {
+				timeout = 0;
+				head++;
+				continue;
+			}
+			io = &ios[cqe->user_data];
+			res = uring_complete(thread, &ring, io, cqe->res, now);
+			head++;
+
+			if (res == 1) {
+				to_submit++;
+				continue;
+			} else if (res == -1) {
+				if (!err)
+					detect_ns = now - io->issue_ns;
+				err = 1;
+			} else if (thread->outage_ns) {
+				device_back(thread, now);
+			}
+			io->count = 0;
+			if (nfree > 0 && free_ios[nfree-1]->count) {
+				/* keep the held back one on top */
+				free_ios[nfree] = free_ios[nfree-1];
+				free_ios[nfree-1] = io;
+			} else {
+				free_ios[nfree] = io;
+			}
+			nfree++;
+			inflight--;
+		}
+		smp_store_release(ring.cq_head, head);
+	} while (1);
+
+	free(free_ios);
+	free(ios);
+	close(ring.fd);
+
+	return err ? -1 : 0;
+}
+
+int do_thread(struct thread_info *thread)
+{
+	FILE *fp;
+	char thread_name[255];
+
+	if (thread->pthreads)
+		thread->tid = syscall(SYS_gettid);
+	else
+		thread->tid = getpid();
+
+	sprintf(thread_name, "/tmp/iogen_thread.%d", thread->tid);
+	fp = fopen(thread_name, "w+");
+	if (fp == NULL) {
+		fprintf(stderr, "Couldn't open %s: %s\n",
+			thread_name, strerror(errno));
+		thread_exit(thread, 1);
+	}
+	setvbuf(fp, NULL, _IONBF, 1);
+	thread->fp = fp;
+
+	/* Catch and report terminating signals, then
 	 * perform their default action (terminate).
+	 * With --pthreads, main() does this for all threads.
+	 */
+	if (!thread->pthreads) {
+		this = thread;
+		signal(SIGHUP, sighandler_thread);
+		signal(SIGINT, sighandler_thread);
+		signal(SIGTERM, sighandler_thread);
+		signal(SIGUSR1, sighandler_thread);
+		signal(SIGUSR2, sighandler_thread);
+	}
+
+	pin_thread(thread);
+
+	fprintf(fp, "iogen, version: %s\n", iogen_version);
+	print_time(fp);
+	fprintf(fp, "Thread: %s: %d\n", thread->pthreads ? "tid" : "pid",
+		thread->tid);
+	if (thread->group)
+		fprintf(fp, "Group: %s\n", thread->group);
+	fprintf(fp, "CPU: %d\n", thread->cpu);
+	fprintf(fp, "NUMA node: %d\n", thread->node);
+	fprintf(fp, "Seed: %u\n", thread->seed);
+	fprintf(fp, "Dry run: %d\n", thread->dry_run);
+	fprintf(fp, "IO log: %s\n", thread->io_log ? "yes" : "no");
+	fprintf(fp, "Min io: %llu\n", thread->min_io);
+	fprintf(fp, "Max io: %llu\n", thread->max_io);
+	fprintf(fp, "Min span: %llu\n", thread->min_span);
+	fprintf(fp, "Fixed: %s\n", thread->fixed ? "yes" : "no");
+	fprintf(fp, "Sequential: %s\n", thread->seq ? "yes" : "no");
+	fprintf(fp, "Distribution: %s\n",
+		thread->dist ? thread->dist->spec : "uniform");
+	fprintf(fp, "Rwmix read: %u%%\n", thread->rwmix_read);
+	fprintf(fp, "BS split: %s\n", thread->bssplit ? "yes" : "no");
+	fprintf(fp, "O_DIRECT: %s\n", thread->o_direct ? "yes" : "no");
+	fprintf(fp, "O_SYNC: %s\n", thread->o_sync ? "yes" : "no");
+	fprintf(fp, "Restart: %s\n", thread->restart ? "yes" : "no");
+
+	fprintf(fp, "Sync: %s every %llu writes, %llu bytes\n",
+		thread->sync_data ? "fdatasync" : "fsync", thread->sync_every,
+		thread->sync_bytes);
+	fprintf(fp, "FUA: %s\n", thread->fua ? "yes" : "no");
+	fprintf(fp, "Discard: %u%%\n", thread->discard_pct);
+	fprintf(fp, "Zero: %u%%\n", thread->zero_pct);
+	if (thread->payload)
+		fprintf(fp, "Payload: compress %u%%, dedupe %u%%\n",
+			thread->compress_pct, thread->dedupe_pct);
+	if (thread->op == COPY)
+		fprintf(fp, "Copy to: %s, method: %s\n", thread->copy_to,
+			copy2str[thread->copy_method]);
+	if (thread->zoned)
+		fprintf(fp, "Zoned: max %u open zones\n",
+			thread->max_open_zones);
+	if (thread->files) {
+		fprintf(fp, "Files: %u, fd cache %u\n", thread->files,
+			thread->fd_cache);
+		fprintf(fp, "Metadata: stat %u%%, create %u%%, unlink %u%%, "
+			"rename %u%%\n", thread->stat_pct, thread->create_pct,
+			thread->unlink_pct, thread->rename_pct);
+	}
+
+	if (thread->files) {
+		thread->open_flags = O_RDWR;
+		if (thread->o_direct)
+			thread->open_flags |= O_DIRECT;
+		if (thread->o_sync)
+			thread->open_flags |= O_SYNC;
+		thread->fd = open(thread->device, O_RDONLY | O_DIRECTORY);
+		if (thread->fd == -1) {
+			fprintf(fp, "Couldn't open directory %s : %s\n",
+				thread->device,	strerror(errno));
+			thread_exit(thread, 1);
+		}
+	} else if (!thread->dry_run) {
+		struct stat st;
+
+		thread->open_flags = thread->op == READ ||
+			thread->op == COPY ? O_RDONLY :
+			thread->op == WRITE ? O_WRONLY : O_RDWR;
+		if (thread->op == READ &&
+		    (thread->discard_pct || thread->zero_pct))
+			thread->open_flags = O_RDWR;
+		if (thread->o_direct)
+			thread->open_flags |= O_DIRECT;
+		if (thread->o_sync)
+			thread->open_flags |= O_SYNC;
+		thread->fd = open(thread->device, thread->open_flags);
+		if (thread->fd == -1) {
+			fprintf(fp, "Couldn't open device %s : %s\n",
+				thread->device,	strerror(errno));
+			thread_exit(thread, 1);
+		}
+		thread->is_blk = fstat(thread->fd, &st) == 0 &&
+			S_ISBLK(st.st_mode);
+
+		if (thread->max_span == 0) {
+			off64_t end = lseek64(thread->fd, 0, SEEK_END);
+
+			if (end == -1) {
+				fprintf(thread->fp, "Couldn't determine the size of device %s "
+					"since max-span not given\n", thread->device);
+				fprintf(thread->fp, "error: %s\n", strerror(errno));
+				thread_exit(thread, 1);
+			}
+
+			thread->max_span = end;
+		}
+		if (thread->op == COPY && copy_open(thread))
+			thread_exit(thread, 1);
+	}
+	fprintf(fp, "Max span: %llu\n", thread->max_span);
+	fprintf(fp, "op: %s\n", op2str[thread->op]);
+	fprintf(fp, "Num ios: %lld\n", thread->num_ios);
+	fprintf(fp, "Device: %s\n", thread->device);
+
+	fprintf(fp, "Engine: %s\n", engine2str[thread->engine]);
+	fprintf(fp, "IO depth: %u\n", thread->iodepth);
+
+	if (setup_align(thread) || (thread->seq && seq_setup(thread)) ||
+	    (thread->zoned && zone_setup(thread)) ||
+	    (thread->files && fs_setup(thread)) ||
+	    setup_pool(thread, thread->iodepth * (thread->op == DC ? 2 : 1)) ||
+	    (thread->payload && setup_payload(thread)))
+		thread_exit(thread, 1);
+	seek_io(thread, thread->io_num);
+	fprintf(fp, "First io: %lu\n", thread->io_num);
+	fprintf(fp, "Rate: %.1f IOPS, %.1f B/s\n", thread->rate_iops,
+		thread->rate_bw);
+	if (thread->trace)
+		fprintf(fp, "Trace records: %lu, speed: %g\n",
+			thread->trace_len, thread->replay_speed);
+	fprintf(fp, "Ramp until: %lu ns\n", thread->ramp_ns);
+	fprintf(fp, "Stop at: %lu ns\n", thread->stop_ns);
+	fprintf(fp, "Align: %llu\n", thread->align);
+	fprintf(fp, "Huge pages: %s\n", thread->hugepages ? "yes" : "no");
+
+	if (thread->io_log && io_log_start(thread))
+		thread_exit(thread, 1);
+
+	if (thread->engine == ENGINE_URING && !thread->dry_run)
+		do_uring(thread);
+	else
+		do_sync(thread);
+	io_log_stop(thread);
+	free_buf(thread->pool, thread->pool_size);
+	if (thread->payload_buf)
+		free_buf(thread->payload_buf, thread->payload_size);
+
+	fprintf(fp, "Thread %d done\n", thread->tid);
+
+	if (thread->files)
+		fs_free(thread);
+	else if (!thread->dry_run)
+		close(thread->fd);
+	copy_close(thread);
+	zone_free(thread);
+	print_stats(fp, thread->stats);
+	print_time(fp);
+	fclose(fp);
+	thread->fp = NULL;
+	thread_exit(thread, 0);
+	return 0;
+}
+
+void *do_pthread(void *arg)
+{
+	do_thread(arg);
+	return NULL;
+}
+
+/* ---------- Interval statistics ---------- */
+
+struct interval {
+	uint64_t		start_ns;
+	uint64_t		prev_ns;
+	struct timespec		next;	  /* next tick, CLOCK_MONOTONIC */
+	struct thread_stats	*prev;	  /* per thread */
+	struct thread_stats	cur;
+	struct thread_stats	delta;
+};
+
+struct interval *interval_init(int num_threads)
+{
+	struct interval *iv;
+
+	iv = calloc(1, sizeof(*iv));
+	if (!iv)
+		return NULL;
+	iv->prev = calloc(num_threads, sizeof(*iv->prev));
+	if (!iv->prev) {
+		free(iv);
+		return NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &iv->next);
+	iv->start_ns = iv->prev_ns = iv->next.tv_sec * 1000000000ULL +
+		iv->next.tv_nsec;
+
+	return iv;
+}
+
+/* Sleep until the next tick.
+ */
+void interval_wait(struct interval *iv, unsigned secs)
+{
+	iv->next.tv_sec += secs;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &iv->next,
+			       NULL) == EINTR)
+		;
+}
+
+void print_interval_header(FILE *out, int csv)
+{
+	int i;
+
+	if (!csv)
+		return;
+	fprintf(out, "time_s");
+	for (i = 0; i < LAT_NUM; i++)
+		fprintf(out, ",%s_iops,%s_mibs,%s_p50_us,%s_p99_us,"
+			"%s_p999_us,%s_max_us", lat2csv[i], lat2csv[i],
+			lat2csv[i], lat2csv[i], lat2csv[i], lat2csv[i]);
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+/* Print what the children did since the last call. They keep going
+ * while we read their stats, so this is only approximately one
+ * interval's worth, which is fine for a time series. The final,
+ * partial, interval is only printed if there was IO in it. Each
+ * child resets its stats when its ramp ends, which is why the
+ * deltas are taken per child.
+ */
+void print_interval(FILE *out, int csv, struct interval *iv,
+		    struct thread_stats *stats, int num_threads, int final)
+{
+	struct thread_stats *cur = &iv->cur, *delta = &iv->delta;
+	struct lat_hist *d;
+	uint64_t now = now_ns();
+	double secs, t;
+	int i, j;
+
+	memset(delta, 0, sizeof(*delta));
+	for (i = 0; i < num_threads; i++) {
+		struct thread_stats *prev = &iv->prev[i];
+		uint64_t epoch;
+
+		epoch = __atomic_load_n(&stats[i].epoch, __ATOMIC_ACQUIRE);
+		memset(cur, 0, sizeof(*cur));
+		merge_stats(cur, &stats[i]);
+		if (epoch != prev->epoch)
+			memset(prev, 0, sizeof(*prev));
+
+		delta->bytes_read += stat_delta(cur->bytes_read,
+						prev->bytes_read);
+		delta->bytes_written += stat_delta(cur->bytes_written,
+						   prev->bytes_written);
+		delta->read_iops += stat_delta(cur->read_iops,
+					       prev->read_iops);
+		delta->write_iops += stat_delta(cur->write_iops,
+						prev->write_iops);
+		for (j = 0; j < LAT_NUM; j++)
+			lat_delta(&delta->lat[j], &cur->lat[j],
+				  &prev->lat[j]);
+
+		memcpy(prev, cur, sizeof(*prev));
+		prev->epoch = epoch;
+	}
+
+	secs = (now - iv->prev_ns) / 1e9;
+	t = (now - iv->start_ns) / 1e9;
+	if (secs <= 0)
+		return;
+	if (final && delta->read_iops == 0 && delta->write_iops == 0)
+		return;
+
+	if (csv)
+		fprintf(out, "%.3f", t);
+	else
+		fprintf(out, "[%8.1f s]", t);
+
+	for (i = 0; i < LAT_NUM; i++) {
+		double iops, mibs;
+
+		d = &delta->lat[i];
+		lat_bounds(d);
+		iops = d->count / secs;
+		if (i == LAT_READ)
+			mibs = delta->bytes_read / secs;
+		else if (i == LAT_WRITE)
+			mibs = delta->bytes_written / secs;
+		else if (i == LAT_COPY)
+			mibs = delta->bytes_copied / secs;
+		else
+			mibs = 0;
+		mibs /= 1024*1024;
+
+		if (csv) {
+			fprintf(out, ",%.1f,%.2f,%.1f,%.1f,%.1f,%.1f", iops,
+				mibs, lat_percentile(d, 50) / 1000.0,
+				lat_percentile(d, 99) / 1000.0,
+				lat_percentile(d, 99.9) / 1000.0,
+				d->max / 1000.0);
+		} else if (d->count) {
+			fprintf(out, " %s: %.0f IOPS %.2f MiB/s "
+				"p50/p99/p99.9/max: %.1f/%.1f/%.1f/%.1f usec",
+				lat2str[i], iops, mibs,
+				lat_percentile(d, 50) / 1000.0,
+				lat_percentile(d, 99) / 1000.0,
+				lat_percentile(d, 99.9) / 1000.0,
+				d->max / 1000.0);
+		}
+	}
+	fprintf(out, "\n");
+	fflush(out);
+
+	iv->prev_ns = now;
+}
+
+/* ---------- Report ---------- */
+
+/* The bytes of an op type, as far as they're counted.
+ */
+static uint64_t lat_bytes(struct thread_stats *st, int type)
+{
+	if (type == LAT_READ)
+		return st->bytes_read;
+	else if (type == LAT_WRITE)
+		return st->bytes_written;
+	else if (type == LAT_COPY)
+		return st->bytes_copied;
+
+	return 0;
+}
+
+void json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for ( ; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char) *s < ' ')
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+void report_lat_json(FILE *f, struct lat_hist *h)
+{
+	int i;
+
+	fprintf(f, "{\"min\": %.1f, \"mean\": %.1f", h->min / 1000.0,
+		h->count ? (double) h->sum / h->count / 1000.0 : 0);
+	for (i = 0; i < NUM_LAT_PCTS; i++)
+		fprintf(f, ", \"p%g\": %.1f", lat_pcts[i],
+			lat_percentile(h, lat_pcts[i]) / 1000.0);
+	fprintf(f, ", \"max\": %.1f}", h->max / 1000.0);
+}
+
+/* The figures of st over secs, as the members of a JSON object.
+ * Reads, writes and copies together, then each op type on its own.
+ */
+void report_stats_json(FILE *f, struct thread_stats *st, double secs)
+{
+	uint64_t ios = data_ios(st);
+	struct lat_hist h;
+	int i, n = 0;
+
+	data_lat(&h, st);
+	fprintf(f, "\"bytes_read\": %lu, \"bytes_written\": %lu, "
+		"\"bytes_copied\": %lu, \"ios\": %lu, \"iops\": %.1f, "
+		"\"mibs\": %.3f, \"would_block\": %lu, ", st->bytes_read,
+		st->bytes_written, st->bytes_copied, ios, ios / secs,
+		data_bytes(st) / secs / (1024*1024), st->would_block);
+	fprintf(f, "\"cpu_user_s\": %.3f, \"cpu_sys_s\": %.3f, "
+		"\"cpu_usec_per_io\": %.2f, ", st->user_us / 1e6,
+		st->sys_us / 1e6, ios ? (double) (st->user_us + st->sys_us) /
+		ios : 0);
+	fprintf(f, "\"lat_us\": ");
+	report_lat_json(f, &h);
+	fprintf(f, ", \"ops\": {");
+	for (i = 0; i < LAT_NUM; i++) {
+		if (st->lat[i].count == 0)
+			continue;
+		fprintf(f, "%s\"%s\": {\"ios\": %lu, \"bytes\": %lu, "
+			"\"iops\": %.1f, \"mibs\": %.3f, \"lat_us\": ",
+			n++ ? ", " : "", lat2csv[i], st->lat[i].count,
+			lat_bytes(st, i), st->lat[i].count / secs,
+			lat_bytes(st, i) / secs / (1024*1024));
+		report_lat_json(f, &st->lat[i]);
+		fprintf(f, "}");
+	}
+	fprintf(f, "}");
+}
+
+void report_row_csv(FILE *f, const char *scope, const char *name,
+		    const char *op, uint64_t ios, uint64_t bytes,
+		    struct lat_hist *h, struct thread_stats *st, double secs)
+{
+	int i;
+
+	fprintf(f, "%s,%s,%s,%lu,%lu,%.1f,%.3f,%.1f,%.1f", scope, name, op,
+		ios, bytes, ios / secs, bytes / secs / (1024*1024),
+		h->min / 1000.0,
+		h->count ? (double) h->sum / h->count / 1000.0 : 0);
+	for (i = 0; i < NUM_LAT_PCTS; i++)
+		fprintf(f, ",%.1f", lat_percentile(h, lat_pcts[i]) / 1000.0);
+	fprintf(f, ",%.1f", h->max / 1000.0);
+	if (st)
+		fprintf(f, ",%.3f,%.3f,%.2f\n", st->user_us / 1e6,
+			st->sys_us / 1e6, ios ? (double) (st->user_us +
+							  st->sys_us) / ios : 0);
+	else
+		fprintf(f, ",,,\n");
+}
+
+/* A row for all of st's reads, writes and copies together, with its
+ * CPU time, then one per op type.
+ */
+void report_stats_csv(FILE *f, const char *scope, const char *name,
+		      struct thread_stats *st, double secs)
+{
+	struct lat_hist h;
+	int i;
+
+	data_lat(&h, st);
+	report_row_csv(f, scope, name, "all", data_ios(st), data_bytes(st),
+		       &h, st, secs);
+	for (i = 0; i < LAT_NUM; i++)
+		if (st->lat[i].count)
+			report_row_csv(f, scope, name, lat2csv[i],
+				       st->lat[i].count, lat_bytes(st, i),
+				       &st->lat[i], NULL, secs);
+}
+
+/* Write the results of a run which took secs: all threads', each
+ * device's and each thread's.
+ */
+int report_write(const char *name, int csv, struct thread_info *thread,
+		 struct thread_stats *stats, int num, double secs)
+{
+	struct thread_stats *st;
+	char index[16];
+	FILE *f;
+	int i, j, n = 0;
+
+	f = strcmp(name, "-") ? fopen(name, "w") : stdout;
+	st = malloc(sizeof(*st));
+	if (!f || !st) {
+		fprintf(stderr, "Couldn't write the report %s: %s\n", name,
+			strerror(errno));
+		if (f && f != stdout)
+			fclose(f);
+		free(st);
+		return -1;
+	}
+	if (secs <= 0)
+		secs = 1e-9;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < num; i++)
+		merge_stats(st, &stats[i]);
+	if (csv) {
+		fprintf(f, "scope,name,op,ios,bytes,iops,mibs,lat_min_us,"
+			"lat_mean_us");
+		for (i = 0; i < NUM_LAT_PCTS; i++)
+			fprintf(f, ",lat_p%g_us", lat_pcts[i]);
+		fprintf(f, ",lat_max_us,cpu_user_s,cpu_sys_s,"
+			"cpu_usec_per_io\n");
+		report_stats_csv(f, "total", "all", st, secs);
+	} else {
+		fprintf(f, "{\n  \"version\": ");
+		json_str(f, iogen_version);
+		fprintf(f, ",\n  \"duration_s\": %.3f,\n  \"total\": {",
+			secs);
+		report_stats_json(f, st, secs);
+		fprintf(f, "},\n  \"devices\": [");
+	}
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < i; j++)
+			if (strcmp(thread[j].device, thread[i].device) == 0)
+				break;
+		if (j < i)
+			continue;
+		memset(st, 0, sizeof(*st));
+		for (j = i; j < num; j++)
+			if (strcmp(thread[j].device, thread[i].device) == 0)
+				merge_stats(st, &stats[j]);
+		if (csv) {
+			report_stats_csv(f, "device", thread[i].device, st,
+					 secs);
+		} else {
+			fprintf(f, "%s\n    {\"device\": ", n++ ? "," : "");
+			json_str(f, thread[i].device);
+			fprintf(f, ", ");
+			report_stats_json(f, st, secs);
+			fprintf(f, "}");
+		}
+	}
+
+	if (!csv)
+		fprintf(f, "\n  ],\n  \"threads\": [");
+	for (i = 0; i < num; i++) {
+		memset(st, 0, sizeof(*st));
+		merge_stats(st, &stats[i]);
+		if (csv) {
+			sprintf(index, "%d", i);
+			report_stats_csv(f, "thread", index, st, secs);
+			continue;
+		}
+		fprintf(f, "%s\n    {\"index\": %d, \"pid\": %d, ",
+			i ? "," : "", i, thread[i].pthreads ?
+			thread[i].tid : thread[i].pid);
+		if (thread[i].group) {
+			fprintf(f, "\"group\": ");
+			json_str(f, thread[i].group);
+			fprintf(f, ", ");
+		}
+		fprintf(f, "\"device\": ");
+		json_str(f, thread[i].device);
+		fprintf(f, ", \"cpu\": %d, ", thread[i].cpu);
+		report_stats_json(f, st, secs);
+		fprintf(f, "}");
+	}
+	if (!csv)
+		fprintf(f, "\n  ]\n}\n");
+
+	free(st);
+	if (f != stdout)
+		fclose(f);
+	else
+		fflush(f);
+
+	return 0;
+}
+
+/* ---------- Control socket ---------- */
+
+/* The parent takes one command per line, e.g. "rate 5000", on a UNIX
+ * socket, and replies with a line ending in "ok" or "error: ...".
+ */
+struct control_srv {
+	int	fd;		  /* listening */
+	const char *path;
+	pthread_t pthread;
+	int	done;
+	FILE	*fp;		  /* the parent log */
+	struct control *ctl;
+	struct thread_stats *stats;
+	int	num_threads;
+	uint64_t start_ns;
+};
+
+static const char control_help[] =
+	"stats: all threads' stats so far, and the settings\n"
+	"rate <iops>: limit all threads together to that, 0 for no limit\n"
+	"rwmix <pct>: percent of RW ops which read\n"
+	"iodepth <n>: IOs in flight per thread, up to --iodepth\n"
+	"threads <n>: run only the first n threads, pause the others\n"
+	"pause, resume: all threads\n"
+	"stop: all threads, as if their run time was up\n";
+
+void control_reply(int fd, const char *s)
+{
+	size_t len = strlen(s);
+	ssize_t res;
+
+	while (len > 0) {
+		res = send(fd, s, len, MSG_NOSIGNAL);
+		if (res <= 0)
+			return;
+		s += res;
+		len -= res;
+	}
+}
+
+void control_stats(struct control_srv *srv, int fd)
+{
+	struct control *ctl = srv->ctl;
+	struct thread_stats *st;
+	char reply[512];
+	int i;
+
+	st = calloc(1, sizeof(*st));
+	if (!st) {
+		control_reply(fd, "error: out of memory\n");
+		return;
+	}
+	for (i = 0; i < srv->num_threads; i++)
+		merge_stats(st, &srv->stats[i]);
+	snprintf(reply, sizeof(reply), "elapsed_s %.1f read_ios %lu "
+		 "write_ios %lu bytes_read %lu bytes_written %lu "
+		 "read_p99_us %.1f write_p99_us %.1f rate %llu rwmix %u "
+		 "iodepth %u threads %u paused %d\nok\n",
+		 (now_ns() - srv->start_ns) / 1e9, st->read_iops,
+		 st->write_iops, st->bytes_read, st->bytes_written,
+		 lat_percentile(&st->lat[LAT_READ], 99) / 1000.0,
+		 lat_percentile(&st->lat[LAT_WRITE], 99) / 1000.0,
+		 ctl->set & CTL_RATE ? ctl->rate_iops : 0,
+		 ctl->rwmix_read, ctl->iodepth,
+		 ctl->set & CTL_ACTIVE ? ctl->active : ctl->num_threads,
+		 ctl->paused);
+	free(st);
+	control_reply(fd, reply);
+}
+
+/* Carry out a command, then have the IO threads take it up.
+ */
+void control_cmd(struct control_srv *srv, char *line, int fd)
+{
+	struct control *ctl = srv->ctl;
+	unsigned long long val;
+	char cmd[16];
+	int n;
+
+	n = sscanf(line, "%15s %llu", cmd, &val);
+	if (n < 1)
+		return;
+
+	if (strcmp(cmd, "stats") == 0) {
+		control_stats(srv, fd);
+		return;
+	} else if (strcmp(cmd, "help") == 0) {
+		control_reply(fd, control_help);
+		control_reply(fd, "ok\n");
+		return;
+	} else if (strcmp(cmd, "rate") == 0 && n == 2) {
+		ctl->rate_iops = val;
+		ctl->set |= CTL_RATE;
+	} else if (strcmp(cmd, "rwmix") == 0 && n == 2 && val <= 100) {
+		ctl->rwmix_read = val;
+		ctl->set |= CTL_RWMIX;
+	} else if (strcmp(cmd, "iodepth") == 0 && n == 2 && val > 0) {
+		ctl->iodepth = val;
+		ctl->set |= CTL_IODEPTH;
+	} else if (strcmp(cmd, "threads") == 0 && n == 2 && val > 0) {
+		ctl->active = val;
+		ctl->set |= CTL_ACTIVE;
+	} else if (strcmp(cmd, "pause") == 0) {
+		ctl->paused = 1;
+	} else if (strcmp(cmd, "resume") == 0) {
+		ctl->paused = 0;
+	} else if (strcmp(cmd, "stop") == 0) {
+		ctl->stop = 1;
+	} else {
+		control_reply(fd, "error: incorrect command, try help\n");
+		return;
+	}
+	__atomic_store_n(&ctl->gen, ctl->gen + 1, __ATOMIC_RELEASE);
+
+	fprintf(srv->fp, "Control: %s on ", line);
+	print_time(srv->fp);
+	control_reply(fd, "ok\n");
+}
+
+/* Serve one client at a time until control_stop().
+ */
+void *control_server(void *arg)
+{
+	struct control_srv *srv = arg;
+	struct pollfd pfd;
+	char buf[256], *nl;
+	int cfd = -1, len = 0, res;
+
+	while (!__atomic_load_n(&srv->done, __ATOMIC_ACQUIRE)) {
+		pfd.fd = cfd == -1 ? srv->fd : cfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, CONTROL_POLL_MS * 10) <= 0)
+			continue;
+		if (cfd == -1) {
+			cfd = accept(srv->fd, NULL, NULL);
+			len = 0;
+			continue;
+		}
+
+		res = read(cfd, buf + len, sizeof(buf) - 1 - len);
+		if (res <= 0) {
+			close(cfd);
+			cfd = -1;
+			continue;
+		}
+		len += res;
+		buf[len] = '\0';
+		while ((nl = strchr(buf, '\n'))) {
+			*nl = '\0';
+			if (nl > buf && nl[-1] == '\r')
+				nl[-1] = '\0';
+			control_cmd(srv, buf, cfd);
+			len -= nl + 1 - buf;
+			memmove(buf, nl + 1, len + 1);
+		}
+		if (len == sizeof(buf) - 1) {
+			control_reply(cfd, "error: line too long\n");
+			len = 0;
+		}
+	}
+	if (cfd != -1)
+		close(cfd);
+
+	return NULL;
+}
+
+/* Listen on path, replacing a stale socket there.
+ */
+int control_open(struct control_srv *srv, const char *path,
+		 struct control *ctl, struct thread_stats *stats,
+		 int num_threads, FILE *fp)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	memset(srv, 0, sizeof(*srv));
+	srv->path = path;
+	srv->ctl = ctl;
+	srv->stats = stats;
+	srv->num_threads = num_threads;
+	srv->fp = fp;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Control socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	srv->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (srv->fd == -1 ||
+	    bind(srv->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	    listen(srv->fd, 4) == -1) {
+		fprintf(stderr, "Couldn't listen on %s: %s\n", path,
+			strerror(errno));
+		if (srv->fd != -1)
+			close(srv->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Serve commands from now on, that is once the IO threads started.
+ */
+int control_start(struct control_srv *srv)
+{
+	srv->start_ns = now_ns();
+	if (pthread_create(&srv->pthread, NULL, control_server, srv)) {
+		fprintf(srv->fp, "Couldn't create the control thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void control_stop(struct control_srv *srv)
+{
+	__atomic_store_n(&srv->done, 1, __ATOMIC_RELEASE);
+	pthread_join(srv->pthread, NULL);
+	close(srv->fd);
+	unlink(srv->path);
+}
+
+/* ---------- Job files ---------- */
+
+/* A job file runs groups of threads, each with its own options, at
+ * the same time, e.g.
+ *
+ *	[global]
+ *	runtime=60
+ *	[writers]
+ *	num-threads=4
+ *	op=WRITE
+ *	seq
+ *	fixed=1m
+ *	[readers]
+ *	num-threads=16
+ *	fixed=4k
+ *	device=/dev/sdc
+ *
+ * Keys are long options, set as on the command line, and "device",
+ * which can be repeated. A group without devices does IO to those
+ * on the command line. [global] sections add to the command line,
+ * which all groups start from. Options of the run as a whole, like
+ * --seed, --pthreads, --runtime and --stats-interval, are only taken
+ * from the command line and [global].
+ */
+struct group {
+	char	*name;
+	struct prog_opts opts;
+	int	first;		  /* index of its first thread */
+	struct dist *dist;
+	unsigned long long bs_max;
+	struct trace trace;	  /* of --replay, split at each run */
+
+	/* what opts were parsed from, options then devices */
+	int	argc;
+	char	**argv;
+	int	num_devs;
+	char	**devs;
+};
+
+int job_add(char ***v, int *n, const char *arg)
+{
+	char **nv;
+
+	nv = realloc(*v, (*n + 1) * sizeof(*nv));
+	if (!nv)
+		return -1;
+	*v = nv;
+	nv[*n] = strdup(arg);
+	if (!nv[*n])
+		return -1;
+	(*n)++;
+
+	return 0;
+}
+
+/* Parse g's arguments onto opts.
+ */
+int job_parse(struct group *g, struct prog_opts *opts)
+{
+	int i, res, index_last = -1, num_cpus = opts->num_cpus;
+	int *cpus = opts->cpus;
+
+	for (i = 0; i < g->num_devs; i++)
+		if (job_add(&g->argv, &g->argc, g->devs[i]))
+			return -1;
+
+	/* A cpu list or devices replace, rather than add to, those
+	 * opts start with.
+	 */
+	opts->cpus = NULL;
+	opts->num_cpus = 0;
+	res = cl_get_prog_opts(g->argc, g->argv, cmd_opts, NUM_OPTIONS, opts,
+			       &index_last, SILENT, stderr);
+	if (res && res != CL_NO_ARGS) {
+		fprintf(stderr, "Incorrect options in section [%s]\n",
+			g->name ? g->name : "global");
+		return -1;
+	}
+	if (opts->num_cpus == 0) {
+		opts->num_cpus = num_cpus;
+		opts->cpus = cpus;
+	} else if (opts == &prog_opts) {
+		free(cpus);
+	}
+	if (index_last != -1 && index_last < g->argc) {
+		if (opts == &prog_opts)
+			free_devices(opts);
+		get_devices(opts, index_last, g->argc, g->argv);
+	}
+
+	return 0;
+}
+
+void job_free(struct group *groups, int num_groups)
+{
+	int i, j;
+
+	for (i = 0; i < num_groups; i++) {
+		struct group *g = &groups[i];
+
+		if (g->opts.cpus != prog_opts.cpus)
+			free(g->opts.cpus);
+		if (g->opts.devices != prog_opts.devices)
+			free_devices(&g->opts);
+		for (j = 0; j < g->argc; j++)
+			free(g->argv[j]);
+		for (j = 0; j < g->num_devs; j++)
+			free(g->devs[j]);
+		free(g->argv);
+		free(g->devs);
+		free(g->name);
+		free(g->trace.recs);
+	}
+	free(groups);
+}
+
+/* Read the groups of a job file, applying [global] to prog_opts.
+ */
+int job_load(const char *name, struct group **groups, int *num_groups)
+{
+	struct group global = { 0 }, *g = NULL, *gs = NULL;
+	char line[1024], opt[1024 + 2], *p, *key, *val, *end;
+	int n = 0, lineno = 0, res = -1;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Couldn't open %s: %s\n", name,
+			strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		line[strcspn(line, "#;\r\n")] = '\0';
+		for (p = line; isspace(*p); p++)
+			;
+		for (end = p + strlen(p); end > p && isspace(end[-1]); end--)
+			;
+		*end = '\0';
+		if (*p == '\0')
+			continue;
+
+		if (*p == '[') {
+			if (end[-1] != ']' || end - p < 3)
+				goto Syntax;
+			end[-1] = '\0';
+			if (strcmp(p + 1, "global") == 0) {
+				g = &global;
+			} else {
+				g = realloc(gs, (n + 1) * sizeof(*gs));
+				if (!g)
+					goto Oom;
+				gs = g;
+				g = &gs[n++];
+				memset(g, 0, sizeof(*g));
+				g->name = strdup(p + 1);
+				if (!g->name)
+					goto Oom;
+			}
+			if (job_add(&g->argv, &g->argc, "iogen"))
+				goto Oom;
+			continue;
+		}
+		if (!g)
+			goto Syntax;
+
+		key = p;
+		val = strchr(p, '=');
+		if (val) {
+			for (end = val; end > key && isspace(end[-1]); end--)
+				;
+			*end = '\0';
+			for (val++; isspace(*val); val++)
+				;
+		}
+		if (strcmp(key, "device") == 0) {
+			if (!val || job_add(&g->devs, &g->num_devs, val))
+				goto Syntax;
+			continue;
+		}
+		snprintf(opt, sizeof(opt), "--%s", key);
+		if (job_add(&g->argv, &g->argc, opt) ||
+		    (val && job_add(&g->argv, &g->argc, val)))
+			goto Oom;
+	}
+
+	if (global.argc && job_parse(&global, &prog_opts))
+		goto Out;
+	for (g = gs; g < gs + n; g++) {
+		g->opts = prog_opts;
+		if (job_parse(g, &g->opts))
+			goto Out;
+	}
+	if (n == 0) {
+		fprintf(stderr, "No groups in %s\n", name);
+		goto Out;
+	}
+	*groups = gs;
+	*num_groups = n;
+	gs = NULL;
+	n = 0;
+	res = 0;
+	goto Out;
+ Syntax:
+	fprintf(stderr, "%s:%d: syntax error\n", name, lineno);
+	goto Out;
+ Oom:
+	fprintf(stderr, "Out of memory\n");
+ Out:
+	fclose(f);
+	job_free(gs, n);
+	/* global's arguments are left, prog_opts may point into them */
+	return res;
+}
+
+/* ---------- Main program ---------- */
+
+static struct thread_info *threads;	  /* for sighandler_pthreads() */
+static int num_threads;
+
+/* With --pthreads the signal is taken by the main thread, which
+ * reports for all IO threads.
+ */
+void sighandler_pthreads(int sig)
+{
+	int i;
+
+	for (i = 0; i < num_threads; i++) {
+		struct thread_info *th = &threads[i];
+
+		if (!th->fp)
+			continue;
+		fprintf(th->fp, "Thread %d terminated by signal %d\n",
+			th->tid, sig);
+		print_stats(th->fp, th->stats);
+		print_time(th->fp);
+	}
+	signal(sig, SIG_DFL);
+	kill(getpid(), sig);
+}
+
+static const int term_sigs[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGUSR2 };
+
+#define NUM_TERM_SIGS	(sizeof(term_sigs)/sizeof(term_sigs[0]))
+
+/* Start an IO thread, a child process or a pthread.
+ */
+int start_thread(struct thread_info *thread, FILE *fp)
+{
+	pid_t pid;
+
+	if (thread->pthreads) {
+		if (pthread_create(&thread->pthread, NULL, do_pthread,
+				   thread)) {
+			fprintf(fp, "Couldn't create thread %d\n",
+				thread->index);
+			return -1;
+		}
+		fprintf(fp, "Thread #%d started on ", thread->index);
+		print_time(fp);
+	} else if ((pid = fork()) == 0) {
+		/* child, never returns */
+		fclose(fp);
+		do_thread(thread);
+	} else if (pid == -1) {
+		fprintf(fp, "Couldn't fork: %s\n", strerror(errno));
+		return -1;
+	} else {
+		thread->pid = pid;
+		fprintf(fp, "Thread %d started on ", pid);
+		print_time(fp);
+	}
+
+	return 0;
+}
+
+/* Reap an IO thread which is done, waiting for one if block is set.
+ * Return its pid or tid, 0 if none is done, or -1 on error.
+ */
+pid_t reap_thread(struct thread_info *thread, int done_fd, int block,
+		  int *status)
+{
+	struct pollfd pfd = { .fd = done_fd, .events = POLLIN };
+	void *ret;
+	int index, res;
+
+	if (!thread->pthreads)
+		return waitpid(-1, status, block ? 0 : WNOHANG);
+
+	res = poll(&pfd, 1, block ? -1 : 0);
+	if (res == 0 || (res == -1 && errno == EINTR))
+		return 0;
+	else if (res == -1)
+		return -1;
+	if (read(done_fd, &index, sizeof(index)) != sizeof(index))
+		return -1;
+	pthread_join(thread[index].pthread, &ret);
+	*status = W_EXITCODE((int) (long) ret, 0);
+
+	return thread[index].tid;
+}
+
+/* Check a group's options and fill in their defaults.
+ */
+int group_check(struct group *g)
+{
+	struct prog_opts *opts = &g->opts;
+
+	if (opts->num_devices == 0) {
+		if (prog_opts.job_file)
+			fprintf(stderr, "No devices given for group %s\n",
+				g->name);
+		else
+			fprintf(stderr, "No devices given\n");
+		return -1;
+	}
+
+	if (opts->num_threads == 0)
+		opts->num_threads = 1;
+
+	if (opts->replay && (opts->rate_iops || opts->rate_bw ||
+			     opts->total_rate_iops || opts->total_rate_bw)) {
+		fprintf(stderr, "--replay is paced by the trace, see "
+			"--replay-speed, not by --rate-iops, --rate-bw, "
+			"--total-rate-iops or --total-rate-bw\n");
+		return -1;
+	}
+
+	if (opts->discard_pct + opts->zero_pct + opts->stat_pct +
+	    opts->create_pct + opts->unlink_pct + opts->rename_pct > 100) {
+		fprintf(stderr, "--discard-pct, --zero-pct, --stat-pct, "
+			"--create-pct, --unlink-pct and --rename-pct add up "
+			"to over 100\n");
+		return -1;
+	}
+
+	if ((opts->op == COPY) != !!opts->copy_to) {
+		fprintf(stderr, "--op COPY and --copy-to go together\n");
+		return -1;
+	}
+	if (opts->op == COPY &&
+	    (opts->engine == ENGINE_URING || opts->replay || opts->payload ||
+	     opts->discard_pct || opts->zero_pct)) {
+		fprintf(stderr, "--op COPY needs a sync engine, and no "
+			"--replay, --compress-pct, --dedupe-pct, --discard-pct "
+			"or --zero-pct\n");
+		return -1;
+	}
+
+	if (opts->engine != ENGINE_URING)
+		opts->iodepth = 1;
+	if (opts->iopoll && !opts->o_direct) {
+		fprintf(stderr, "--iopoll needs --o_direct\n");
+		return -1;
+	}
+	if ((opts->hipri || opts->nowait) && opts->engine != ENGINE_PVSYNC2) {
+		fprintf(stderr, "--hipri and --nowait need the pvsync2 "
+			"engine\n");
+		return -1;
+	}
+	if (opts->hipri && !opts->o_direct) {
+		fprintf(stderr, "--hipri needs --o_direct\n");
+		return -1;
+	}
+
+	if (opts->zoned &&
+	    (!opts->o_direct || opts->dry_run || opts->seq || opts->replay ||
+	     opts->op == COPY || opts->discard_pct || opts->zero_pct)) {
+		fprintf(stderr, "--zoned needs --o_direct, and no --dry-run, "
+			"--seq, --replay, --op COPY, --discard-pct or "
+			"--zero-pct\n");
+		return -1;
+	}
+	if (opts->files &&
+	    (opts->engine == ENGINE_URING || opts->dry_run || opts->seq ||
+	     opts->dist != DIST_UNIFORM || opts->replay || opts->zoned ||
+	     opts->op == COPY || opts->restart)) {
+		fprintf(stderr, "--files needs a sync engine, and no "
+			"--dry-run, --seq, --dist, --replay, --zoned, "
+			"--op COPY or --restart\n");
+		return -1;
+	}
+	if (!opts->files && (opts->file_size_spec || opts->stat_pct ||
+			     opts->create_pct || opts->unlink_pct ||
+			     opts->rename_pct)) {
+		fprintf(stderr, "--file-size and the metadata percents need "
+			"--files\n");
+		return -1;
+	}
+	if (opts->files && !opts->file_size_spec) {
+		char *p = FILE_SIZE_DEFAULT;
+
+		parse_bssplit(&p, opts->file_size);
+	}
+
+	if (opts->zoned && opts->max_open_zones &&
+	    opts->max_open_zones < opts->iodepth) {
+		fprintf(stderr, "--max-open-zones is less than the iodepth\n");
+		return -1;
+	}
+
+	if (opts->replay && trace_load(opts->replay, &g->trace))
+		return -1;
+
+	return 0;
+}
+
+/* Set up what the threads of a group share, thread being its first.
+ */
+int group_setup(struct group *g, struct thread_info *thread)
+{
+	struct prog_opts *opts = &g->opts;
+	int i;
+
+	/* The IO buffers are as big as the biggest size */
+	for (i = 0; opts->bssplit_spec && i < 2 * BS_SLOTS; i++)
+		if (opts->bssplit[i / BS_SLOTS][i % BS_SLOTS] > g->bs_max)
+			g->bs_max = opts->bssplit[i / BS_SLOTS][i % BS_SLOTS];
+
+	if (opts->dist != DIST_UNIFORM) {
+		g->dist = dist_build(opts->dist_spec, opts->dist,
+				     opts->dist_a, opts->dist_b,
+				     opts->num_regions, opts->region_access,
+				     opts->region_size);
+		if (!g->dist) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+	}
+
+	if (opts->replay &&
+	    trace_split(&g->trace, thread, opts->num_threads,
+			opts->num_devices)) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The options of a group.
+ */
+void print_opts(FILE *fp, struct group *g)
+{
+	struct prog_opts *opts = &g->opts;
+	int i;
+
+	fprintf(fp, "Dry run: %s\n", opts->dry_run ? "yes" : "no");
+	fprintf(fp, "IO log: %s\n", opts->io_log ? "yes" : "no");
+	fprintf(fp, "Num threads: %d\n", opts->num_threads);
+	fprintf(fp, "Min io: %llu\n", opts->min_io);
+	fprintf(fp, "Max io: %llu\n", opts->max_io);
+	fprintf(fp, "Min span: %llu\n", opts->min_span);
+	fprintf(fp, "Max span: %llu\n", opts->max_span);
+	fprintf(fp, "op: %s\n", op2str[opts->op]);
+	fprintf(fp, "Num ios: %lld\n", opts->num_ios);
+	fprintf(fp, "First io: %llu\n", opts->first_io);
+	if (opts->replay) {
+		fprintf(fp, "Replay: %s\n", opts->replay);
+		fprintf(fp, "Replay speed: %g\n", opts->replay_speed);
+		fprintf(fp, "Trace records: %lu\n", g->trace.len);
+	}
+	fprintf(fp, "Rate: %llu IOPS, %llu B/s per thread, "
+		"%llu IOPS, %llu B/s total\n", opts->rate_iops,
+		opts->rate_bw, opts->total_rate_iops,
+		opts->total_rate_bw);
+	fprintf(fp, "Arrival: %s\n", opts->poisson ? "poisson" : "const");
+	fprintf(fp, "Burst: %llu ms on, %llu ms off\n", opts->burst_on_ms,
+		opts->burst_off_ms);
+	fprintf(fp, "Fixed: %s\n", opts->fixed ? "yes" : "no");
+	fprintf(fp, "Sequential: %s\n", opts->seq ? "yes" : "no");
+	if (opts->seq) {
+		fprintf(fp, "Seq layout: %s", seq2str[opts->seq_layout]);
+		if (opts->seq_layout == SEQ_STRIDE)
+			fprintf(fp, ":%llu", opts->seq_stride);
+		fprintf(fp, "\n");
+		fprintf(fp, "Seq reverse: %s\n",
+			opts->seq_reverse ? "yes" : "no");
+		fprintf(fp, "Seq skip: %llu\n", opts->seq_skip);
+	}
+	fprintf(fp, "Distribution: %s\n", opts->dist_spec);
+	fprintf(fp, "Rwmix read: %u%%\n", opts->rwmix_read);
+	fprintf(fp, "BS split: %s\n", opts->bssplit_spec ?
+		opts->bssplit_spec : "none");
+	fprintf(fp, "Num devices: %d\n", opts->num_devices);
+	fprintf(fp, "O_DIRECT: %s\n", opts->o_direct ? "yes" : "no");
+	fprintf(fp, "O_SYNC: %s\n", opts->o_sync ? "yes" : "no");
+	fprintf(fp, "Restart: %s\n", opts->restart ? "yes" : "no");
+	fprintf(fp, "Sync: %s every %llu writes, %llu bytes\n",
+		opts->sync_data ? "fdatasync" : "fsync", opts->sync_every,
+		opts->sync_bytes);
+	fprintf(fp, "FUA: %s\n", opts->fua ? "yes" : "no");
+	fprintf(fp, "Discard: %u%%\n", opts->discard_pct);
+	fprintf(fp, "Zero: %u%%\n", opts->zero_pct);
+	if (opts->payload)
+		fprintf(fp, "Payload: compress %u%%, dedupe %u%%\n",
+			opts->compress_pct, opts->dedupe_pct);
+	if (opts->copy_to)
+		fprintf(fp, "Copy to: %s, method: %s\n", opts->copy_to,
+			copy2str[opts->copy_method]);
+	if (opts->zoned)
+		fprintf(fp, "Zoned: max %u open zones per thread\n",
+			opts->max_open_zones ? opts->max_open_zones :
+			opts->iodepth);
+	if (opts->files) {
+		fprintf(fp, "Files: %u per thread, sizes %s, fd cache %u\n",
+			opts->files, opts->file_size_spec ?
+			opts->file_size_spec : FILE_SIZE_DEFAULT,
+			opts->fd_cache);
+		fprintf(fp, "Metadata: stat %u%%, create %u%%, unlink %u%%, "
+			"rename %u%%\n", opts->stat_pct, opts->create_pct,
+			opts->unlink_pct, opts->rename_pct);
+	}
+	fprintf(fp, "Engine: %s\n", engine2str[opts->engine]);
+	fprintf(fp, "IO depth: %u\n", opts->iodepth);
+	fprintf(fp, "SQ poll: %s\n", opts->sqpoll ? "yes" : "no");
+	fprintf(fp, "IO poll: %s\n", opts->iopoll ? "yes" : "no");
+	if (opts->engine == ENGINE_PVSYNC2)
+		fprintf(fp, "RWF_HIPRI: %s, RWF_NOWAIT: %s\n",
+			opts->hipri ? "yes" : "no", opts->nowait ? "yes" : "no");
+	fprintf(fp, "Align: %llu\n", opts->align);
+	fprintf(fp, "Huge pages: %s\n", opts->hugepages ? "yes" : "no");
+	fprintf(fp, "CPUs:");
+	for (i = 0; i < opts->num_cpus; i++)
+		fprintf(fp, " %d", opts->cpus[i]);
+	fprintf(fp, "\n");
+	for (i = 0; i < opts->num_devices; i++)
+		fprintf(fp, "    Device%d: %s\n", i, opts->devices[i]);
+}
+
+/* Thread j of group g, its index already set.
+ */
+void init_thread(struct thread_info *thread, struct group *g, int j)
+{
+	struct prog_opts *opts = &g->opts;
+
+	thread->group = g->name;
+	thread->io_num = opts->first_io;
+	thread->rate_iops = rate_limit(opts->rate_iops,
+		(double) opts->total_rate_iops / opts->num_threads);
+	thread->rate_bw = rate_limit(opts->rate_bw,
+		(double) opts->total_rate_bw / opts->num_threads);
+	thread->poisson = opts->poisson;
+	thread->burst_on_ns = opts->burst_on_ms * 1000000ULL;
+	thread->burst_off_ns = opts->burst_off_ms * 1000000ULL;
+	thread->dry_run = opts->dry_run;
+	thread->io_log = opts->io_log;
+	thread->min_io = opts->min_io;
+	thread->max_io = opts->max_io;
+	thread->min_span = opts->min_span;
+	thread->max_span = opts->max_span;
+	thread->num_ios = opts->num_ios;
+	thread->op = opts->op;
+	thread->device = opts->devices[j % opts->num_devices];
+	thread->fixed = opts->fixed;
+	thread->seq = opts->seq;
+	thread->seq_layout = opts->seq_layout;
+	thread->seq_stride = opts->seq_stride;
+	thread->seq_reverse = opts->seq_reverse;
+	thread->seq_skip = opts->seq_skip;
+	thread->seq_rank = j / opts->num_devices;
+	thread->seq_peers = (opts->num_threads - j % opts->num_devices +
+			     opts->num_devices - 1) / opts->num_devices;
+	thread->dist = g->dist;
+	thread->rwmix_read = opts->rwmix_read;
+	if (opts->bssplit_spec) {
+		thread->bssplit = opts->bssplit;
+		thread->max_io = g->bs_max;
+	}
+	thread->o_direct = opts->o_direct;
+	thread->o_sync = opts->o_sync;
+	thread->restart = opts->restart;
+	thread->sync_every = opts->sync_every;
+	thread->sync_bytes = opts->sync_bytes;
+	thread->sync_data = opts->sync_data;
+	thread->fua = opts->fua;
+	thread->discard_pct = opts->discard_pct;
+	thread->zero_pct = opts->zero_pct;
+	thread->payload = opts->payload;
+	thread->compress_pct = opts->compress_pct;
+	thread->dedupe_pct = opts->dedupe_pct;
+	thread->copy_to = opts->copy_to;
+	thread->copy_method = opts->copy_method;
+	thread->copy_fd = -1;
+	thread->copy_pipe[0] = thread->copy_pipe[1] = -1;
+	thread->zoned = opts->zoned;
+	thread->max_open_zones = opts->max_open_zones ? opts->max_open_zones :
+		opts->iodepth;
+	thread->files = opts->files;
+	thread->file_size = opts->file_size;
+	thread->fd_cache = opts->fd_cache;
+	thread->stat_pct = opts->stat_pct;
+	thread->create_pct = opts->create_pct;
+	thread->unlink_pct = opts->unlink_pct;
+	thread->rename_pct = opts->rename_pct;
+	thread->meta_pct = opts->stat_pct + opts->create_pct +
+		opts->unlink_pct + opts->rename_pct;
+	thread->engine = opts->engine;
+	thread->iodepth = opts->iodepth;
+	thread->max_inflight = opts->iodepth;
+	thread->sqpoll = opts->sqpoll;
+	thread->iopoll = opts->iopoll;
+	thread->rw_flags = (opts->hipri ? RWF_HIPRI : 0) |
+		(opts->nowait ? RWF_NOWAIT : 0);
+	thread->align = opts->align;
+	thread->hugepages = opts->hugepages;
+	thread->cpu = opts->num_cpus ?
+		opts->cpus[thread->index % opts->num_cpus] : -1;
+	if (opts->replay)
+		replay_setup(thread, opts->replay_speed);
+}
+
+/* Run the groups' threads until they're done, logging to fp. Return
+ * their merged stats in total, and for how long they counted them.
+ */
+uint64_t run_groups(struct group *groups, int num_groups, FILE *fp,
+		    struct thread_stats *total)
+{
+	int i, left, total_threads = 0;
+	int done_pipe[2] = { -1, -1 };
+	struct thread_info *thread;
+	struct thread_stats *stats;
+	struct interval *iv = NULL;
+	struct control *ctl = NULL;
+	struct control_srv srv;
+	struct group *g;
+	uint64_t start_ns, ramp_ns = 0, stop_ns = 0, res;
+
+	for (g = groups; g < groups + num_groups; g++) {
+		g->first = total_threads;
+		total_threads += g->opts.num_threads;
+	}
+
+	thread = malloc(total_threads * sizeof(*thread));
+	if (!thread) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(thread, 0, total_threads * sizeof(*thread));
+
+	for (g = groups; g < groups + num_groups; g++)
+		if (group_setup(g, &thread[g->first]))
+			exit(1);
+
+	/* The children account their IO here, so that we can merge
+	 * it when they're done.
 	 */
-	signal(SIGHUP, sighandler_thread);
-	signal(SIGINT, sighandler_thread);
-	signal(SIGTERM, sighandler_thread);
-	signal(SIGUSR1, sighandler_thread);
-	signal(SIGUSR2, sighandler_thread);
+	stats = mmap(NULL, total_threads * sizeof(*stats),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
 
-	fprintf(fp, "iogen, version: %s\n", iogen_version);
-	print_time(fp);
-	fprintf(fp, "Thread: pid: %d\n", getpid());
-	fprintf(fp, "Seed: %u\n", thread->seed);
-	fprintf(fp, "Dry run: %d\n", thread->dry_run);
-	fprintf(fp, "IO log: %s\n", thread->io_log ? "yes" : "no");
-	fprintf(fp, "Min io: %llu\n", thread->min_io);
-	fprintf(fp, "Max io: %llu\n", thread->max_io);
-	fprintf(fp, "Min span: %llu\n", thread->min_span);
-	fprintf(fp, "Fixed: %s\n", thread->fixed ? "yes" : "no");
-	fprintf(fp, "Sequential: %s\n", thread->seq ? "yes" : "no");
-	fprintf(fp, "O_DIRECT: %s\n", thread->o_direct ? "yes" : "no");
-	fprintf(fp, "O_SYNC: %s\n", thread->o_sync ? "yes" : "no");
-	fprintf(fp, "Restart: %s\n", thread->restart ? "yes" : "no");
+	if (prog_opts.control) {
+		ctl = mmap(NULL, sizeof(*ctl), PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (ctl == MAP_FAILED) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		ctl->num_threads = total_threads;
+		ctl->rwmix_read = groups[0].opts.rwmix_read;
+		ctl->iodepth = groups[0].opts.iodepth;
+		if (control_open(&srv, prog_opts.control, ctl, stats,
+				 total_threads, fp))
+			exit(1);
+	}
 
-	if (!thread->dry_run) {
-		thread->open_flags = thread->op == READ ? O_RDONLY :
-			thread->op == WRITE ? O_WRONLY : O_RDWR;
-		if (thread->o_direct)
-			thread->open_flags |= O_DIRECT;
-		if (thread->o_sync)
-			thread->open_flags |= O_SYNC;
-		thread->fd = open(thread->device, thread->open_flags);
-		if (thread->fd == -1) {
-			fprintf(fp, "Couldn't open device %s : %s\n",
-				thread->device,	strerror(errno));
+	if (prog_opts.pthreads) {
+		sigset_t set;
+
+		if (pipe(done_pipe) == -1) {
+			fprintf(stderr, "Couldn't create a pipe: %s\n",
+				strerror(errno));
 			exit(1);
 		}
 
-		if (thread->max_span == 0) {
-			off64_t end = lseek64(thread->fd, 0, SEEK_END);
+		/* The IO threads inherit this and leave the
+		 * terminating signals to the main thread.
+		 */
+		sigemptyset(&set);
+		for (i = 0; i < NUM_TERM_SIGS; i++)
+			sigaddset(&set, term_sigs[i]);
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+		threads = thread;
+		num_threads = total_threads;
+	}
 
-			if (end == -1 || errno) {
-				fprintf(thread->fp, "Couldn't determine the size of device %s "
-					"since max-span not given\n", thread->device);
-				fprintf(thread->fp, "error: %s\n", strerror(errno));
+	/* All threads ramp and stop at the same time, however long
+	 * each took to start.
+	 */
+	start_ns = now_ns();
+	if (prog_opts.ramp_time)
+		ramp_ns = start_ns + prog_opts.ramp_time * 1000000000ULL;
+	if (prog_opts.runtime)
+		stop_ns = start_ns + (prog_opts.ramp_time +
+				      prog_opts.runtime) * 1000000000ULL;
+
+	for (g = groups; g < groups + num_groups; g++) {
+		for (i = g->first; i < g->first + g->opts.num_threads; i++) {
+			thread[i].index = i;
+			thread[i].stats = &stats[i];
+			thread[i].seed = lrand48();
+			thread[i].ramp_ns = ramp_ns;
+			thread[i].stop_ns = stop_ns;
+			thread[i].pthreads = prog_opts.pthreads;
+			thread[i].done_fd = done_pipe[1];
+			thread[i].ctl = ctl;
+			init_thread(&thread[i], g, i - g->first);
+
+			if (start_thread(&thread[i], fp))
 				exit(1);
-			}
+		}
+	}
 
-			thread->max_span = end;
+	/* When the children quit we report their status,
+	 * then we quit too. */
+	if (prog_opts.pthreads) {
+		sigset_t set;
+
+		sigemptyset(&set);
+		for (i = 0; i < NUM_TERM_SIGS; i++) {
+			signal(term_sigs[i], sighandler_pthreads);
+			sigaddset(&set, term_sigs[i]);
 		}
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	} else {
+		signal(SIGINT, SIG_IGN);
 	}
-	fprintf(fp, "Max span: %llu\n", thread->max_span);
-	fprintf(fp, "op: %s\n", op2str[thread->op]);
-	fprintf(fp, "Num ios: %lld\n", thread->num_ios);
-	fprintf(fp, "Device: %s\n", thread->device);
 
-	if (thread->max_io <= SMALL_BUF_LIMIT) {
-		thread->big_buf = 0;
-		thread->buf = malloc(thread->max_io);
+	if (ctl && control_start(&srv))
+		exit(1);
 
-		if (!thread->buf) {
-			fprintf(fp, "Couldn't allocate a buffer of size %llu\n",
-				thread->max_io);
+	if (prog_opts.stats_interval) {
+		iv = interval_init(total_threads);
+		if (!iv) {
+			fprintf(stderr, "Out of memory\n");
 			exit(1);
 		}
+		print_interval_header(stdout, prog_opts.stats_csv);
+	}
 
-		if (thread->op == DC) {
-			thread->buf2 = malloc(thread->max_io);
-			if (!thread->buf2) {
-				fprintf(fp, "Couldn't allocate a second "
-					"buffer of size %llu\n",
-					thread->max_io);
-				exit(1);
+	left = total_threads;
+	while (left > 0) {
+		int	status;
+		pid_t	pid;
+
+		if (iv) {
+			pid = reap_thread(thread, done_pipe[0], 0, &status);
+			if (pid == 0) {
+				interval_wait(iv, prog_opts.stats_interval);
+				print_interval(stdout, prog_opts.stats_csv, iv,
+					       stats, total_threads, 0);
+				continue;
 			}
+		} else {
+			pid = reap_thread(thread, done_pipe[0], 1, &status);
+			if (pid == 0)
+				continue;
 		}
-	} else {
-		thread->big_buf = 1;
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (WIFSIGNALED(status)) {
+			fprintf(fp, "Thread %d terminated by signal %d, "
+				"status %d on ", pid, WTERMSIG(status),
+				WEXITSTATUS(status));
+		} else {
+			fprintf(fp, "Thread %d exited with status %d on ", pid,
+				WEXITSTATUS(status));
+		}
+		print_time(fp);
+		left--;
 	}
 
-	do {
-		int res;
+	if (ctl) {
+		control_stop(&srv);
+		munmap(ctl, sizeof(*ctl));
+	}
 
-		res = do_io_op(thread);
-		if (res == -1 && thread->restart)
-			wait_for_device(thread);
-		else if (res == -1)
-			break;
+	if (iv) {
+		print_interval(stdout, prog_opts.stats_csv, iv, stats,
+			       total_threads, 1);
+		free(iv->prev);
+		free(iv);
+	}
 
-		if (thread->num_ios == -1)
-			;
-		else if (--thread->num_ios <= 0)
-			break;
-	} while (1);
+	for (g = groups; prog_opts.job_file && g < groups + num_groups; g++) {
+		memset(total, 0, sizeof(*total));
+		for (i = g->first; i < g->first + g->opts.num_threads; i++)
+			merge_stats(total, &stats[i]);
+		fprintf(fp, "Group %s:\n", g->name);
+		print_stats(fp, total);
+	}
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < total_threads; i++)
+		merge_stats(total, &stats[i]);
+	/* Until the last thread exited, rather than until it was reaped,
+	 * which can be up to a stats interval later
+	 */
+	res = (total->end_ns ? total->end_ns : now_ns()) -
+		(ramp_ns ? ramp_ns : start_ns);
+
+	if (prog_opts.report && !prog_opts.slo_p99)
+		report_write(prog_opts.report, prog_opts.report_csv, thread,
+			     stats, total_threads, res / 1e9);
 
-	if (!thread->big_buf) {
-		free(thread->buf);
-		if (thread->op == DC)
-			free(thread->buf2);
+	munmap(stats, total_threads * sizeof(*stats));
+	for (i = 0; i < total_threads; i++)
+		free(thread[i].trace);
+	free(thread);
+	threads = NULL;
+	num_threads = 0;
+	for (g = groups; g < groups + num_groups; g++) {
+		dist_free(g->dist);
+		g->dist = NULL;
+	}
+	if (done_pipe[0] != -1) {
+		close(done_pipe[0]);
+		close(done_pipe[1]);
 	}
 
-	fprintf(fp, "Thread %d done\n", getpid());
+	return res;
+}
+
 
-	if (!thread->dry_run)
-		close(thread->fd);
-	print_stats(thread);
-	print_time(fp);
-	fclose(fp);
-	exit(0);
+/* ---------- SLO search ---------- */
+
+#define SLO_RUNTIME	10	  /* s per trial, unless told otherwise */
+#define SLO_MAX_CONC	256
+#define SLO_GAIN	1.05	  /* less than that is past the knee */
+#define SLO_RATE_STEPS	4
+
+/* One run of the group at a given concurrency and offered rate.
+ */
+struct slo_point {
+	unsigned conc;
+	unsigned long long rate;  /* total IOPS, 0 for unlimited */
+	double	iops;
+	double	mibs;
+	uint64_t p99;
+	int	ok;
+};
+
+static const char *slo_knob(struct group *g)
+{
+	return g->opts.engine == ENGINE_URING ? "iodepth" : "threads";
 }
 
-/* ---------- Main program ---------- */
+void print_slo_point(FILE *out, int csv, struct group *g, int n,
+		     struct slo_point *pt)
+{
+	if (csv)
+		fprintf(out, "%d,%u,%llu,%.1f,%.2f,%.1f,%d\n", n, pt->conc,
+			pt->rate, pt->iops, pt->mibs, pt->p99 / 1000.0,
+			pt->ok);
+	else
+		fprintf(out, "SLO trial %2d: %s %3u, rate %8llu: %.0f IOPS "
+			"%.2f MiB/s p99 %.1f usec%s\n", n, slo_knob(g),
+			pt->conc, pt->rate, pt->iops, pt->mibs,
+			pt->p99 / 1000.0, pt->ok ? "" : " over");
+	fflush(out);
+}
+
+/* Run the group with conc threads, or IOs in flight per thread, at
+ * a total of rate IOPS, and see if its p99 meets the SLO.
+ */
+void slo_trial(struct group *g, FILE *fp, struct thread_stats *total,
+	       int n, unsigned conc, unsigned long long rate,
+	       struct slo_point *pt)
+{
+	struct lat_hist h;
+	double secs;
+
+	if (g->opts.engine == ENGINE_URING)
+		g->opts.iodepth = conc;
+	else
+		g->opts.num_threads = conc;
+	g->opts.total_rate_iops = rate;
+
+	fprintf(fp, "SLO trial %d: %s %u, rate %llu IOPS\n", n, slo_knob(g),
+		conc, rate);
+	secs = run_groups(g, 1, fp, total) / 1e9;
+	fprintf(fp, "All threads:\n");
+	print_stats(fp, total);
+
+	data_lat(&h, total);
+	pt->conc = conc;
+	pt->rate = rate;
+	pt->iops = secs > 0 ? h.count / secs : 0;
+	pt->mibs = secs > 0 ? data_bytes(total) / secs / (1024*1024) : 0;
+	pt->p99 = lat_percentile(&h, 99);
+	pt->ok = h.count && pt->p99 <= prog_opts.slo_p99 * 1000;
+
+	print_slo_point(stdout, prog_opts.stats_csv, g, n, pt);
+	print_slo_point(fp, 0, g, n, pt);
+}
+
+/* Find the knee of the throughput/latency curve under the p99 SLO.
+ * Double the concurrency while the SLO holds and IOPS keep growing,
+ * bisect it between the last good and the first bad, then bisect
+ * the offered rate at the first bad concurrency, as that may yet
+ * give more IOPS than the last good one with no limit.
+ */
+void slo_search(struct group *g, FILE *fp, struct thread_stats *total)
+{
+	struct slo_point pt, best = { 0 };
+	unsigned conc, lo = 0, hi = 0;
+	double hi_iops = 0, rlo, rhi;
+	int i, n = 0;
+
+	if (prog_opts.stats_csv)
+		printf("trial,%s,rate,iops,mibs,p99_usec,ok\n", slo_knob(g));
+
+	for (conc = 1; conc <= SLO_MAX_CONC; conc *= 2) {
+		slo_trial(g, fp, total, n++, conc, 0, &pt);
+		if (!pt.ok) {
+			hi = conc;
+			hi_iops = pt.iops;
+			break;
+		}
+		lo = conc;
+		if (pt.iops > best.iops) {
+			if (best.ok && pt.iops < best.iops * SLO_GAIN) {
+				best = pt;
+				break;
+			}
+			best = pt;
+		} else if (best.ok) {
+			break;
+		}
+	}
+
+	while (hi && hi - lo > 1) {
+		conc = lo + (hi - lo) / 2;
+		slo_trial(g, fp, total, n++, conc, 0, &pt);
+		if (pt.ok) {
+			lo = conc;
+			if (pt.iops > best.iops)
+				best = pt;
+		} else {
+			hi = conc;
+			hi_iops = pt.iops;
+		}
+	}
+
+	rlo = best.iops;
+	rhi = hi_iops;
+	for (i = 0; hi && i < SLO_RATE_STEPS && rhi > rlo + 1; i++) {
+		slo_trial(g, fp, total, n++, hi,
+			  (unsigned long long) ((rlo + rhi) / 2), &pt);
+		if (pt.ok) {
+			rlo = pt.rate;
+			if (pt.iops > best.iops)
+				best = pt;
+		} else {
+			rhi = pt.rate;
+		}
+	}
+
+	if (!best.ok) {
+		printf("No operating point meets the p99 SLO of %llu usec\n",
+		       prog_opts.slo_p99);
+		fprintf(fp, "No operating point meets the p99 SLO of "
+			"%llu usec\n", prog_opts.slo_p99);
+		return;
+	}
+	printf("Best: %s %u, rate %llu: %.0f IOPS %.2f MiB/s p99 %.1f usec\n",
+	       slo_knob(g), best.conc, best.rate, best.iops, best.mibs,
+	       best.p99 / 1000.0);
+	fprintf(fp, "Best: %s %u, rate %llu: %.0f IOPS %.2f MiB/s "
+		"p99 %.1f usec\n", slo_knob(g), best.conc, best.rate,
+		best.iops, best.mibs, best.p99 / 1000.0);
+}
 
 int main(int argc, char *argv[])
 {
-	int res, i;
+	int res;
 	int index_last = -1;
-	struct thread_info *thread;
+	const char *simd;
+	struct thread_stats *total;
+	struct group *groups, *g;
+	int num_groups;
 	char parent_name[255];
+	double secs;
 	FILE *fp;
 
 	res = cl_get_prog_opts(argc, argv, cmd_opts, NUM_OPTIONS, &prog_opts,
@@ -791,24 +7435,48 @@ int main(int argc, char *argv[])
 		exit(res == CL_NO_ARGS ? 0 : res);
 	}
 
-	if (index_last == -1 || index_last >= argc) {
-		fprintf(stderr, "No devices given\n");
-		exit(1);
+	simd = pattern_select(prog_opts.simd);
+
+	if (prog_opts.decode_log)
+		exit(io_log_decode(prog_opts.decode_log, stdout) ? 1 : 0);
+
+	if (index_last != -1 && index_last < argc)
+		get_devices(&prog_opts, index_last, argc, argv);
+
+	if (prog_opts.slo_p99) {
+		if (prog_opts.job_file || prog_opts.replay ||
+		    prog_opts.report) {
+			fprintf(stderr, "--slo-p99 doesn't go with %s\n",
+				prog_opts.job_file ? "--job-file" :
+				prog_opts.replay ? "--replay" : "--report");
+			exit(1);
+		}
+		if (prog_opts.runtime == 0 && prog_opts.num_ios == -1)
+			prog_opts.runtime = SLO_RUNTIME;
 	}
 
-	res = get_devices(index_last, argc, argv);
-	if (res)
-		exit(1);
+	if (prog_opts.job_file) {
+		if (job_load(prog_opts.job_file, &groups, &num_groups))
+			exit(1);
+	} else {
+		groups = calloc(1, sizeof(*groups));
+		if (!groups) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		groups[0].opts = prog_opts;
+		num_groups = 1;
+	}
 
-	if (prog_opts.num_threads == 0)
-		prog_opts.num_threads = 1;
+	for (g = groups; g < groups + num_groups; g++)
+		if (group_check(g))
+			exit(1);
 
-	thread = malloc(prog_opts.num_threads * sizeof(*thread));
-	if (!thread) {
+	total = calloc(1, sizeof(*total));
+	if (!total) {
 		fprintf(stderr, "Out of memory\n");
 		exit(1);
 	}
-	memset(thread, 0, prog_opts.num_threads * sizeof(*thread));
 
 	srand48(prog_opts.seed);
 
@@ -825,80 +7493,43 @@ int main(int argc, char *argv[])
 	print_time(fp);
 	fprintf(fp, "Parent: pid: %d\n", getpid());
 	fprintf(fp, "Seed: %u\n", prog_opts.seed);
-	fprintf(fp, "Dry run: %s\n", prog_opts.dry_run ? "yes" : "no");
-	fprintf(fp, "IO log: %s\n", prog_opts.io_log ? "yes" : "no");
-	fprintf(fp, "Num threads: %d\n", prog_opts.num_threads);
-	fprintf(fp, "Min io: %llu\n", prog_opts.min_io);
-	fprintf(fp, "Max io: %llu\n", prog_opts.max_io);
-	fprintf(fp, "Min span: %llu\n", prog_opts.min_span);
-	fprintf(fp, "Max span: %llu\n", prog_opts.max_span);
-	fprintf(fp, "op: %s\n", op2str[prog_opts.op]);
-	fprintf(fp, "Num ios: %lld\n", prog_opts.num_ios);
-	fprintf(fp, "Fixed: %s\n", prog_opts.fixed ? "yes" : "no");
-	fprintf(fp, "Sequential: %s\n", prog_opts.seq ? "yes" : "no");
-	fprintf(fp, "Num devices: %d\n", prog_opts.num_devices);
-	fprintf(fp, "O_DIRECT: %s\n", prog_opts.o_direct ? "yes" : "no");
-	fprintf(fp, "O_SYNC: %s\n", prog_opts.o_sync ? "yes" : "no");
-	fprintf(fp, "Restart: %s\n", prog_opts.restart ? "yes" : "no");
-	for (i = 0; i < prog_opts.num_devices; i++)
-		fprintf(fp, "    Device%d: %s\n", i, prog_opts.devices[i]);
-
-	for (i = 0; i < prog_opts.num_threads; i++) {
-		pid_t pid;
-
-		thread[i].index = i;
-		thread[i].seed = lrand48();
-		thread[i].dry_run = prog_opts.dry_run;
-		thread[i].io_log = prog_opts.io_log;
-		thread[i].min_io = prog_opts.min_io;
-		thread[i].max_io = prog_opts.max_io;
-		thread[i].min_span = prog_opts.min_span;
-		thread[i].max_span = prog_opts.max_span;
-		thread[i].num_ios = prog_opts.num_ios;
-		thread[i].op = prog_opts.op;
-		thread[i].device = prog_opts.devices[i%prog_opts.num_devices];
-		thread[i].fixed = prog_opts.fixed;
-		thread[i].seq = prog_opts.seq;
-		thread[i].o_direct = prog_opts.o_direct;
-		thread[i].o_sync = prog_opts.o_sync;
-		thread[i].restart = prog_opts.restart;
-
-		if ((pid = fork()) == 0) {
-			/* child, never returns */
-			fclose(fp);
-			do_thread(&thread[i]);
-		} else {
-			thread[i].pid = pid;
-			fprintf(fp, "Thread %d started on ", pid);
-			print_time(fp);
-		}
+	fprintf(fp, "Runtime: %llu s\n", prog_opts.runtime);
+	fprintf(fp, "Ramp time: %llu s\n", prog_opts.ramp_time);
+	fprintf(fp, "Stats interval: %u\n", prog_opts.stats_interval);
+	fprintf(fp, "Pthreads: %s\n", prog_opts.pthreads ? "yes" : "no");
+	fprintf(fp, "SIMD: %s\n", simd);
+	if (prog_opts.job_file)
+		fprintf(fp, "Job file: %s\n", prog_opts.job_file);
+	if (prog_opts.slo_p99)
+		fprintf(fp, "SLO p99: %llu usec\n", prog_opts.slo_p99);
+	if (prog_opts.control)
+		fprintf(fp, "Control: %s\n", prog_opts.control);
+	if (prog_opts.report)
+		fprintf(fp, "Report: %s, %s\n", prog_opts.report,
+			prog_opts.report_csv ? "csv" : "json");
+	for (g = groups; g < groups + num_groups; g++) {
+		if (prog_opts.job_file)
+			fprintf(fp, "Group: %s\n", g->name);
+		print_opts(fp, g);
 	}
 
-	/* When the children quit we report their status,
-	 * then we quit too. */
-	signal(SIGINT, SIG_IGN);
-
-	do {
-		int	status;
-		pid_t	pid;
-
-		pid = wait(&status);
-
-		if (WIFSIGNALED(status)) {
-			fprintf(fp, "Thread %d terminated by signal %d, "
-				"status %d on ", pid, WTERMSIG(status),
-				WEXITSTATUS(status));
-		} else {
-			fprintf(fp, "Thread %d exited with status %d on ", pid,
-				WEXITSTATUS(status));
-		}
-		print_time(fp);
-	} while (--prog_opts.num_threads > 0);
+	if (prog_opts.slo_p99) {
+		slo_search(groups, fp, total);
+	} else {
+		secs = run_groups(groups, num_groups, fp, total) / 1e9;
+		fprintf(fp, "All threads:\n");
+		print_stats(fp, total);
+		fprintf(fp, "Duration: %.3f s, %.0f IOPS, %.2f MiB/s\n", secs,
+			data_ios(total) / secs, data_bytes(total) / secs /
+			(1024*1024));
+	}
 
 	print_time(fp);
 	fclose(fp);
-	free(thread);
-	free_devices();
+	free(total);
+	job_free(groups, num_groups);
+	free(prog_opts.cpus);
+	free_devices(&prog_opts);
 
 	return 0;
 }